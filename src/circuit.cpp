@@ -21,155 +21,202 @@ Author: Matthew Amy
 
 #include <algorithm>
 #include <sstream>
+#include <deque>
+#include <future>
 
 #include <boost/optional.hpp>
 
 #include "circuit.h"
 #include "xor_func.h"
 #include "oracle.h"
+#include "rank_tracker.h"
+#include "worker_pool.h"
 
 using namespace std;
 
+int layer_workers = 0;
+
 // Forward decl to use in construct
-void insert_phase (unsigned char c, xor_func f, map<xor_func, unsigned char> & phases);
+void insert_phase (unsigned char c, const xor_func & f, term_table & terms,
+    vector<exponent_val> & phases);
+void insert_ccz_phase (const xor_func & a, const xor_func & b, const xor_func & c,
+    term_table & terms, vector<exponent_val> & phases,
+    vector<term_table::block> & scratch);
 // Parse a {CNOT, T} circuit
 // NOTE: a qubit's number is NOT the same as the bit it's value represents
-character::character(const dotqc &input) :
-    n(input.n),
-    m(input.m),
-    h(input.count_h()),
-    names(n + m + h),
+character_builder::character_builder(const dotqc & header, int expected_h) :
+    n(header.n),
+    m(header.m),
+    width(header.n + expected_h),
+    names(n + m + expected_h),
     zero(n + m),
-    val_map(),
-    phase_expts(),
-    outputs(),
-    hadamards()
+    terms(width)
 {
-    int val_max = 0;
-    map<string, int> name_map, gate_lookup;
-    gate_lookup["T"] = 1;
-    gate_lookup["T*"] = 7;
-    gate_lookup["P"] = 2;
-    gate_lookup["P*"] = 6;
-    gate_lookup["Z"] = 4;
-    gate_lookup["Y"] = 4; // TODO investigate
-
-    // TODO fix for permutations by actually reading the output list
-    // TODO hm?
-    for(int i = 0; i < n + m; i++) {
-        outputs.push_back(xor_func(n+m));
-        /* outputs.at(i).set(i); */
-    }
-    // Initialize names and wires
-    vector<xor_func> wires;
+    // Initialize names and wires. A qubit's wire is its index in the header
     wires.reserve( n + m );
-    int name_max = 0;
-    for (const auto& name : input.names) {
-        // name_map maps a name to a wire
-        name_map[name] = name_max;
+    for (const auto& name : header.names) {
         // names maps a wire to a name
         names[name_max] = name;
         // zero mapping
-        zero[name_max]  = input.zero.at(name);
+        zero[name_max]  = header.zero.at(name);
         // each wire has an initial value j, unless it starts in the 0 state
-        wires.push_back(xor_func(n + h));
+        wires.push_back(xor_func(width));
         if (!zero[name_max]) {
+            while (val_max >= width) grow();
             wires[name_max].set(val_max);
             val_map[val_max++] = name_max;
         }
         name_max++;
     }
+    initial_wires = wires;
+    last_wires = wires;
+}
 
-    // map<string, int> name_map
-    // type gatelist = [(Str, [Str]]
-    int gate_index = -1;
-    for (const auto& gate : input.circ ) {
-        bool flg = false;
-        gate_index++;
-        if (gate.first == "tof" && gate.second.size() == 2) {
-            auto gate_inputs_it = gate.second.begin();
-            int first_input = name_map[*gate_inputs_it];
-            gate_inputs_it++;
-            int second_input = name_map[*gate_inputs_it];
-            wires[second_input] ^= wires[first_input];
-        } else if ((gate.first == "tof" || gate.first == "X")
-                && gate.second.size() == 1) {
-            int first_input = name_map[*(gate.second.begin())];
-            wires[first_input].negate();
-        } else if (gate.first == "Y" && gate.second.size() == 1) {
-            int first_input = name_map[*(gate.second.begin())];
-            insert_phase(gate_lookup[gate.first], wires[first_input], phase_expts);
-            wires[first_input].negate();
-        } else if (gate.first == "T" || gate.first == "T*" ||
-                gate.first == "P" || gate.first == "P*" ||
-                (gate.first == "Z" && gate.second.size() == 1)) {
-            int first_input = name_map[*(gate.second.begin())];
-            insert_phase(gate_lookup[gate.first], wires[first_input], phase_expts);
-        } else if (gate.first == "Z" && gate.second.size() == 3) {
-            list<string>::const_iterator tmp_it = gate.second.begin();
-            // The three inputs
-            int a = name_map[*(tmp_it++)];
-            int b = name_map[*(tmp_it++)];
-            int c = name_map[*tmp_it];
-            insert_phase(1, wires[a], phase_expts);
-            insert_phase(1, wires[b], phase_expts);
-            insert_phase(1, wires[c], phase_expts);
-            insert_phase(7, wires[a] ^ wires[b], phase_expts);
-            insert_phase(7, wires[a] ^ wires[c], phase_expts);
-            insert_phase(7, wires[b] ^ wires[c], phase_expts);
-            insert_phase(1, wires[a] ^ wires[b] ^ wires[c], phase_expts);
-        } else if (gate.first == "H") {
-            // This WILL confuse you later on you idiot
-            //   You zero the "destroyed" qubit, compute the rank, then replace the
-            //   value with each of the phase exponents to see if the rank increases
-            //   i.e. the system is inconsistent. This is so you don't have to make
-            //   a new matrix -- i.e. instead of preparing the new value and computing
-            //   rank, then adding each phase exponent and checking the rank you do it
-            //   in place
-            Hadamard new_h;
-            new_h.qubit = name_map[*(gate.second.begin())];
-            new_h.prep  = val_max++;
-            new_h.wires = wires;
-
-            // Check previous exponents to see if they're inconsistent
-            wires[new_h.qubit].reset();
-            int rank = compute_rank(n + m, n + h, wires);
-            for (const auto& expt : phase_expts) {
-                if (expt.second != 0) {
-                    wires[new_h.qubit] = expt.first;
-                    if (compute_rank(n + m, n + h, wires) > rank) {
-                        new_h.in.insert(expt.first);
-                    }
-                }
-            }
+// Doubles the room for the values hadamards prepare. The wires and terms are
+//   widened right away; the initial wires and the hadamards' changes only
+//   when the character is made
+void character_builder::grow() {
+    width = n + max(2 * (width - n), 16);
+    terms.resize(width);
+    for (auto & wire : wires) wire.resize(width);
+    for (auto & wire : last_wires) wire.resize(width);
+    names.resize(n + m + (width - n));
+}
 
-            // Done creating the new hadamard
-            hadamards.push_back(new_h);
-
-            // Prepare the new value
-            wires[new_h.qubit].reset();
-            wires[new_h.qubit].set(new_h.prep);
-
-            // Give this new value a name
-            val_map[new_h.prep] = name_max;
-            names[name_max] = names[new_h.qubit];
-            names[name_max++].append(to_string(new_h.prep));
-
-        } else {
-            cout << "ERROR: not a {H, CNOT, X, Y, Z, P, T} circuit" << endl;
-            cout << "on the " << gate_index << "th gate_index" << endl;
-            cout << "gate.first is: '" << gate.first << "'" << endl;
-            cout << "gate.second is: [";
-            for (const auto& i : gate.second) {
-                cout << i << ", ";
+void character_builder::add_gate(const gate & g) {
+    static const map<gate_type, int> gate_lookup = {
+        {gate_type::T, 1}, {gate_type::T_DAG, 7}, {gate_type::P, 2},
+        {gate_type::P_DAG, 6}, {gate_type::Z, 4},
+        {gate_type::Y, 4}, // TODO investigate
+    };
+
+    gate_index++;
+    if (g.type == gate_type::TOF && g.size == 2) {
+        wires[g.wires[1]] ^= wires[g.wires[0]];
+    } else if ((g.type == gate_type::TOF || g.type == gate_type::X)
+            && g.size == 1) {
+        wires[g.wires[0]].negate();
+    } else if (g.type == gate_type::Y && g.size == 1) {
+        insert_phase(gate_lookup.at(g.type), wires[g.wires[0]], terms, phase_expts);
+        wires[g.wires[0]].negate();
+    } else if (g.type == gate_type::T || g.type == gate_type::T_DAG ||
+            g.type == gate_type::P || g.type == gate_type::P_DAG ||
+            (g.type == gate_type::Z && g.size == 1)) {
+        insert_phase(gate_lookup.at(g.type), wires[g.wires[0]], terms, phase_expts);
+    } else if (g.type == gate_type::Z && g.size == 3) {
+        // The three inputs
+        insert_ccz_phase(wires[g.wires[0]], wires[g.wires[1]], wires[g.wires[2]],
+            terms, phase_expts, scratch);
+    } else if (g.type == gate_type::H) {
+        // A phase term has to be applied before this hadamard if it can't
+        //   be computed from the other wires once this qubit is destroyed.
+        //   The wires are eliminated once and every term is reduced against
+        //   the result, rather than ranking the wires with each term in turn
+        if (val_max >= width) grow();
+        Hadamard new_h;
+        new_h.qubit = g.wires[0];
+        new_h.prep  = val_max++;
+        h++;
+        for (int i = 0; i < n + m; i++) {
+            if (!(wires[i] == last_wires[i])) {
+                new_h.changes.emplace_back(i, wires[i]);
+                last_wires[i] = wires[i];
             }
-            cout << "]" << endl;
-            throw logic_error("Can't parse circuit");
+        }
+
+        // Check previous exponents to see if they're inconsistent
+        boost::dynamic_bitset<> used = wires[new_h.qubit].bits();
+        wires[new_h.qubit].reset();
+        vector<term_id> live;
+        for (term_id id = 0; id < phase_expts.size(); id++) {
+            if (phase_expts[id] != 0) live.push_back(id);
+        }
+        new_h.in = terms.outside_span(live, wires);
+
+        // Done creating the new hadamard
+        hadamards.push_back(new_h);
+
+        // Prepare the new value. Start from a fresh function, so the
+        //   negation of the destroyed value isn't carried over
+        wires[new_h.qubit] = xor_func(width);
+        wires[new_h.qubit].set(new_h.prep);
+
+        // Give this new value a name
+        val_map[new_h.prep] = name_max;
+        names[name_max] = names[new_h.qubit];
+        names[name_max++].append(to_string(new_h.prep));
+
+    } else {
+        cout << "ERROR: not a {H, CNOT, X, Y, Z, P, T} circuit" << endl;
+        cout << "on the " << gate_index << "th gate_index" << endl;
+        cout << "gate is: '" << gate_name(g.type) << "'" << endl;
+        cout << "on: [";
+        for (int q : g) {
+            cout << names[q] << ", ";
+        }
+        cout << "]" << endl;
+        throw logic_error("Can't parse circuit");
+    }
+}
+
+static character_builder parse_gates(const dotqc & input) {
+    character_builder builder(input, input.count_h());
+    for (const auto& gate : input.circ) builder.add_gate(gate);
+    return builder;
+}
+
+character::character(const dotqc &input) :
+    character(parse_gates(input))
+{ }
+
+character::character(character_builder && builder) :
+    n(builder.n),
+    m(builder.m),
+    h(builder.h),
+    names(move(builder.names)),
+    zero(move(builder.zero)),
+    val_map(move(builder.val_map)),
+    terms(move(builder.terms)),
+    phase_expts(move(builder.phase_expts)),
+    outputs(),
+    initial_wires(move(builder.initial_wires)),
+    hadamards(move(builder.hadamards))
+{
+    // TODO fix for permutations by actually reading the output list
+    // TODO hm?
+    for(int i = 0; i < n + m; i++) {
+        outputs.push_back(xor_func(n+m));
+        /* outputs.at(i).set(i); */
+    }
 
-            phase_expts.clear();
+    // Drop the room the builder left for values that never came
+    names.resize(n + m + h);
+    if (terms.width() != (size_t)(n + h)) {
+        terms.resize(n + h);
+        for (auto & wire : initial_wires) wire.resize(n + h);
+        for (Hadamard & had : hadamards) {
+            for (auto & change : had.changes) change.second.resize(n + h);
         }
     }
 
+    // Terms were numbered as they were found. Renumber them so that sets of
+    //   ids iterate in the same order as the corresponding xor_funcs, and
+    //   drop the ones whose phases cancelled out
+    vector<bool> keep(phase_expts.size());
+    for (term_id id = 0; id < phase_expts.size(); id++) keep[id] = phase_expts[id] != 0;
+    const vector<term_id> renumber = terms.sort(keep);
+    vector<exponent_val> sorted_expts(terms.size());
+    for (term_id id = 0; id < renumber.size(); id++) {
+        if (renumber[id] != term_table::dropped) sorted_expts[renumber[id]] = phase_expts[id];
+    }
+    phase_expts.swap(sorted_expts);
+    for (Hadamard & had : hadamards) {
+        term_set in;
+        for (const term_id id : had.in) {
+            if (renumber[id] != term_table::dropped) in.insert(renumber[id]);
+        }
+        had.in.swap(in);
+    }
 }
 
 void character::output(ostream& out) const {
@@ -185,12 +232,13 @@ void character::output(ostream& out) const {
   out << "> --> w^(";
 
   // Print the phase exponents
-  for (auto it = phase_expts.begin(); it != phase_expts.end(); it++) {
-    if (it != phase_expts.begin()) out << "+";
-    out << (int)(it->second) << "*";
-    if (it->first.is_negated()) out << "~";
+  for (term_id id = 0; id < phase_expts.size(); id++) {
+    const xor_func f = terms[id];
+    if (id != 0) out << "+";
+    out << (int)(phase_expts[id]) << "*";
+    if (f.is_negated()) out << "~";
     for (int i = 0; i < (n + h); i++) {
-      if (it->first.test(i)) out << names.at(val_map.at(i));
+      if (f.test(i)) out << names.at(val_map.at(i));
     }
   }
   out << ")|";
@@ -253,90 +301,237 @@ void insert_phase (unsigned char c, xor_func f, map<xor_func, unsigned char> & p
   */
 }
 
+void insert_phase (unsigned char c, const xor_func & f, term_table & terms,
+    vector<exponent_val> & phases) {
+  const term_id id = terms.intern(f);
+  if (id >= phases.size()) phases.resize(id + 1, 0);
+  phases[id] = (phases[id] + c) % 8;
+}
+
+// Adds the phase of a doubly controlled Z on wires a, b and c, which is
+//   w^(a + b + c - a^b - a^c - b^c + a^b^c). The parities are formed in
+//   scratch, one packed row per term, instead of as temporary xor_funcs,
+//   and each term is looked up once
+void insert_ccz_phase (const xor_func & a, const xor_func & b, const xor_func & c,
+    term_table & terms, vector<exponent_val> & phases,
+    vector<term_table::block> & scratch) {
+  static const exponent_val coeffs[7] = {1, 1, 1, 7, 7, 7, 1};
+  const size_t stride = terms.blocks();
+  bool negated[7];
+
+  scratch.assign(7 * stride, 0);
+  term_table::block * row[7];
+  for (int i = 0; i < 7; i++) row[i] = scratch.data() + i * stride;
+  a.to_blocks(row[0]);
+  b.to_blocks(row[1]);
+  c.to_blocks(row[2]);
+  for (size_t w = 0; w < stride; w++) {
+    row[3][w] = row[0][w] ^ row[1][w];
+    row[4][w] = row[0][w] ^ row[2][w];
+    row[5][w] = row[1][w] ^ row[2][w];
+    row[6][w] = row[3][w] ^ row[2][w];
+  }
+  negated[0] = a.is_negated();
+  negated[1] = b.is_negated();
+  negated[2] = c.is_negated();
+  negated[3] = negated[0] ^ negated[1];
+  negated[4] = negated[0] ^ negated[2];
+  negated[5] = negated[1] ^ negated[2];
+  negated[6] = negated[3] ^ negated[2];
+
+  for (int i = 0; i < 7; i++) {
+    const term_id id = terms.intern(row[i], negated[i]);
+    if (id >= phases.size()) phases.resize(id + 1, 0);
+    phases[id] = (phases[id] + coeffs[i]) % 8;
+  }
+}
+
 
+// Only appends the new qubits, so it's cheap to call repeatedly in the middle
+//   of synthesize_unbounded
 void character::add_ancillae(int num) {
-  int num_qubits = this->n + this->m + num;
-  stringstream ss;
+  // Ancillae start at zero and are never touched, so the hadamards' changes
+  //   don't mention them
+  initial_wires.resize(n + m + num, xor_func(n + h));
+  outputs.resize(n + m + num, xor_func(n + h));
+  zero.resize(n + m + num, true);
+
+  // The ancillae take over the names after the qubits', numbered on from
+  //   those added by earlier calls
+  names.resize(n + m);
+  const int added = count_if(names.begin(), names.end(),
+      [](const string & name) { return name.compare(0, 5, "__anc") == 0; });
+  for (int i = 0; i < num; i++) {
+    names.push_back("__anc" + to_string(added + i));
+  }
+  m += num;
+}
 
-  int new_m = this->m + num;
-  vector<string> new_names(num_qubits);
-  vector<bool> new_zero(num_qubits);
-  vector<xor_func> new_out;
-  new_out.reserve(num_qubits);
+//---------------------------- Synthesis
 
-  for (auto it = hadamards.begin(); it != hadamards.end(); it++) {
-    for (int i = n + m; i < num_qubits; i++) {
-      it->wires.push_back(xor_func(n + h));
+// Terms waiting to be partitioned, by parity of their phase. A term becomes
+//   available once the highest value it uses is prepared, and values are
+//   prepared in increasing order, so each term is filed once under that value
+//   and handed over when it's prepared. waiting[j][v + 1] holds the terms
+//   released by value v, and waiting[j][0] those using no values at all
+struct term_schedule {
+  vector<vector<term_id>> waiting[2];
+  size_t remaining = 0;
+
+  term_schedule(const term_table & terms, const vector<exponent_val> & phase,
+      int num_values) {
+    for (int j = 0; j < 2; j++) waiting[j].resize(num_values + 1);
+    for (term_id id = 0; id < phase.size(); id++) {
+      if (phase[id] == 0) continue;
+      waiting[phase[id] % 2 == 1 ? 0 : 1][terms.highest_var(id) + 1].push_back(id);
+      remaining++;
     }
   }
 
-  for (int i = 0; i < num_qubits; i++) {
-    if (i < (n + m)) {
-      new_names[i] = names[i];
-      new_zero[i]  = zero[i];
-      new_out.push_back(outputs[i]);
-    } else {
-      ss.str("");
-      ss << "__anc" << i - (n + m);
-      new_names[i] = ss.str();
-      new_zero[i] = true;
-      new_out.push_back(xor_func(n + h));
+  // Terms of parity j released by the values [first, last), in id order
+  vector<term_id> release(int j, int first, int last) {
+    vector<term_id> ret;
+    for (int v = first; v < last; v++) {
+      vector<term_id> & bucket = waiting[j][v + 1];
+      ret.insert(ret.end(), bucket.begin(), bucket.end());
+      vector<term_id>().swap(bucket);
     }
+    if (last - first > 1) sort(ret.begin(), ret.end());
+    remaining -= ret.size();
+    return ret;
   }
+};
+
+// Add newly available terms to the partition, in the order selected by
+//   term_order
+static void partition_available(partitioning & floats, vector<term_id> avail,
+    const term_table & terms, const ind_oracle & oracle, exchange_cache & cache,
+    list<Hadamard>::const_iterator pending, list<Hadamard>::const_iterator last) {
+  order_terms(avail, terms, term_order, [pending, last](term_id id) {
+    int ret = 0;
+    for (auto it = pending; it != last; it++) {
+      if (it->in.count(id)) ret++;
+    }
+    return ret;
+  });
 
-  this->names = new_names;
-  this->zero = new_zero;
-  this->outputs = new_out;
-  this->m = new_m;
+  for (const term_id id : avail) {
+    add_to_partition(floats, id, oracle, cache);
+  }
 }
 
-//---------------------------- Synthesis
+static void append_gates(gatelist & circ, const gatelist & gates) {
+  circ.insert(circ.end(), gates.begin(), gates.end());
+}
+
+// Builds the {CNOT, T} layers on the shared workers and passes their gates
+//   to a sink in the order they were pushed. Each layer only reads the
+//   partitions and wire states it was given, so the caller can go on
+//   partitioning while they're built. At most layer_workers layers are in
+//   flight, after which push waits for the oldest. Within a task of the pool,
+//   such as a region, the layers are built in place, as waiting there could
+//   hold up the pool
+class layer_pipeline {
+  struct layer {
+    future<gatelist> gates;
+    gatelist after;     // gates pushed while the layer was still being built
+  };
+  gate_sink out;
+  deque<layer> pending;
+
+  void finish_oldest() {
+    for (const gate & g : pending.front().gates.get()) out(g);
+    for (const gate & g : pending.front().after) out(g);
+    pending.pop_front();
+  }
+
+public:
+  explicit layer_pipeline(gate_sink out) : out(out) { }
+  ~layer_pipeline() {
+    for (auto & l : pending) {
+      if (l.gates.valid()) l.gates.wait();
+    }
+  }
+
+  void push(function<gatelist()> build) {
+    if (layer_workers <= 0 || worker_pool::in_task()) {
+      for (const gate & g : build()) out(g);
+      return;
+    }
+    while (pending.size() >= (size_t)layer_workers) finish_oldest();
+    pending.push_back(layer{shared_workers().submit(build), gatelist()});
+  }
+
+  void push_gate(const gate & g) {
+    if (pending.empty()) out(g);
+    else pending.back().after.push_back(g);
+  }
+
+  void finish() {
+    while (!pending.empty()) finish_oldest();
+  }
+};
+
+dotqc character::empty_circuit() const {
+  dotqc ret{};
+
+  ret.n = n;
+  ret.m = m;
+  for (int i = 0; i < n + m; i++) {
+    ret.names.push_back(names[i]);
+    ret.zero[names[i]] = zero[i];
+  }
+  return ret;
+}
 
 dotqc character::synthesize() {
+  dotqc ret = empty_circuit();
+
+  synthesize([&ret](const gate & g) { ret.circ.push_back(g); });
+  return ret;
+}
+
+void character::synthesize(gate_sink out) {
   partitioning floats[2], frozen[2];
-  dotqc ret{};
-  // TODO investigate mask, is +1 needed?
-  xor_func mask(n + h);      // Tells us what values we have prepared
+  exchange_cache caches[2];             // Exchange graph edges found so far
   vector<xor_func> wires;        // Current state of the wires
   wires.reserve(n+m);
-  list<xor_func> remaining[2];          // Which terms we still have to partition
-  int dim = n;
+  vector<xor_func> snapshot = initial_wires; // State of the wires at the current hadamard
+  term_schedule schedule(terms, phase_expts, n + h); // Which terms we still have to partition
+  int dim = n, num_init = 0;
   int tdepth = 0, h_count = 1, applied = 0;
-  ind_oracle oracle(n + m, dim, n + h);
+  ind_oracle oracle(n + m, dim, n + h, &terms);
+  swap_relabeler relabel(n + m, out);
+  layer_pipeline layers([&relabel](const gate & g) { relabel.push(g); });
+  restart_term_order();   // the same result on whichever thread this runs
+  // Both parities of a layer, from the wires in to the wires out
+  auto build_layer = [this](const partitioning & odd, const partitioning & even,
+      const vector<xor_func> & in, const vector<xor_func> & out) {
+    const layer_context ctx(in, n + m, n + h);
+    auto ret = construct_circuit(terms, phase_expts, odd, ctx, in, n + m, n + h);
+    auto tmp = construct_circuit(terms, phase_expts, even, ctx, out, n + m, n + h);
+    append_gates(ret, tmp);
+    return ret;
+  };
 
   assert(this->outputs.size() > 0);
 
   // initialize some stuff
-  ret.n = n;
-  ret.m = m;
-  mask.negate();
-  for (int i = 0, j = 0; i < n + m; i++) {
-    ret.names.push_back(names[i]);
-    ret.zero[names[i]] = zero[i];
+  for (int i = 0; i < n + m; i++) {
     wires.push_back(xor_func(n + h));
     if (!zero[i]) {
-      wires[i].set(j);
-      mask.set(j++);
+      wires[i].set(num_init++);
     }
   }
-
-  // initialize the remaining list
-  for (const auto& xpt : phase_expts) {
-    if (xpt.second % 2 == 1) remaining[0].push_back(xpt.first);
-    else if (xpt.second != 0) remaining[1].push_back(xpt.first);
-  }
+  rank_tracker wire_rank(wires);   // Rank of the current wires
 
   // create an initial partition
   // cerr << "Adding new functions to the partition... " << flush;
   for (int j = 0; j < 2; j++) {
-    for (auto it = remaining[j].begin(); it != remaining[j].end();) {
-      if (mask.contains(*it)) {
-        add_to_partition(floats[j], *it, oracle);
-        it = remaining[j].erase(it);
-      } else it++;
-    }
+    partition_available(floats[j], schedule.release(j, -1, num_init), terms, oracle,
+        caches[j], hadamards.begin(), hadamards.end());
   }
-  if (disp_log) cerr << "  " << phase_expts.size() - (remaining[0].size() + remaining[1].size())
+  if (disp_log) cerr << "  " << phase_expts.size() - schedule.remaining
     << "/" << phase_expts.size() << " phase rotations partitioned\n" << flush;
 
   for (auto it = hadamards.begin(); it != hadamards.end(); it++, h_count++) {
@@ -345,53 +540,49 @@ dotqc character::synthesize() {
     // 3. apply the hadamard gate
     // 4. add new functions to the partition
     if (disp_log) cerr << "  Hadamard " << h_count << "/" << hadamards.size() << "\n" << flush;
+    it->replay(snapshot);
 
     // determine frozen partitions
     for (int j = 0; j < 2; j++) {
       frozen[j] = freeze_partitions(floats[j], it->in);
+      caches[j].invalidate(frozen[j]);
       applied += num_elts(frozen[j]);
     }
 
     // Construct {CNOT, T} subcircuit for the frozen partitions
-    {
-        auto tmp = construct_circuit(phase_expts, frozen[0], wires, wires, n + m, n + h, names);
-        ret.circ.splice(ret.circ.end(), tmp);
-        tmp = construct_circuit(phase_expts, frozen[1], wires, it->wires, n + m, n + h, names);
-        ret.circ.splice(ret.circ.end(), tmp);
-    }
+    layers.push(bind(build_layer, move(frozen[0]), move(frozen[1]), wires, snapshot));
     for (int i = 0; i < n + m; i++) {
-      wires[i] = it->wires[i];
+      wires[i] = snapshot[i];
+    }
+    for (const auto & change : it->changes) {
+      wire_rank.replace(change.first, change.second);
     }
     if (disp_log) cerr << "    " << applied << "/" << phase_expts.size() << " phase rotations applied\n" << flush;
 
     // Apply Hadamard gate
-    ret.circ.push_back(make_pair("H", list<string>(1, names[it->qubit])));
+    layers.push_gate(gate(gate_type::H, {it->qubit}));
     wires[it->qubit].reset();
     wires[it->qubit].set(it->prep);
-    mask.set(it->prep);
+    wire_rank.replace(it->qubit, wires[it->qubit]);
 
     // Check for increases in dimension
-    int rank = compute_rank(n + m, n + h, &wires[0]);
+    int rank = wire_rank.rank();
     if (rank > dim) {
       if (disp_log) cerr << "    Dimension increased to " << rank << ", fixing partitions...\n" << flush;
       dim = rank;
       oracle.set_dim(dim);
-      repartition(floats[0], oracle);
-      repartition(floats[1], oracle);
+      repartition(floats[0], oracle, caches[0]);
+      repartition(floats[1], oracle, caches[1]);
     }
 
     // Add new functions to the partition
     for (int j = 0; j < 2; j++) {
-      for (auto it = remaining[j].begin(); it != remaining[j].end();) {
-        if (mask.contains(*it)) {
-          add_to_partition(floats[j], *it, oracle);
-          it = remaining[j].erase(it);
-        } else it++;
-      }
+      partition_available(floats[j], schedule.release(j, it->prep, it->prep + 1),
+          terms, oracle, caches[j], next(it), hadamards.end());
     }
     if (disp_log) {
         cerr << "    "
-            << phase_expts.size() - (remaining[0].size() + remaining[1].size())
+            << phase_expts.size() - schedule.remaining
             << "/" << phase_expts.size() << " phase rotations partitioned\n"
             << flush;
     }
@@ -399,57 +590,42 @@ dotqc character::synthesize() {
 
   applied += num_elts(floats[0]) + num_elts(floats[1]);
   // Construct the final {CNOT, T} subcircuit
-  {
-      auto tmp = construct_circuit(this->phase_expts, floats[0],
-              wires, wires, n + m, n + h, this->names);
-      ret.circ.splice(ret.circ.end(), tmp);
-      tmp = construct_circuit(this->phase_expts, floats[1],
-              wires, this->outputs, n + m, n + h, this->names);
-      ret.circ.splice(ret.circ.end(), tmp);
-  }
+  layers.push(bind(build_layer, move(floats[0]), move(floats[1]), wires, this->outputs));
+  layers.finish();
+  relabel.finish();
   if (disp_log) cerr << "  " << applied << "/" << phase_expts.size() << " phase rotations applied\n" << flush;
-
-  return ret;
 }
 
 dotqc character::synthesize_unbounded() {
   partitioning floats[2], frozen[2];
+  exchange_cache caches[2];
   dotqc ret;
-  xor_func mask(n + h);      // Tells us what values we have prepared
   vector<xor_func> wires; // Current state of the wires
   wires.reserve(n + m);
-  list<xor_func> remaining[2];          // Which terms we still have to partition
-  int dim = n, tmp1, tmp2, tdepth = 0, h_count = 1, applied = 0, j;
-  ind_oracle oracle(n + m, dim, n + h);
+  vector<xor_func> snapshot = initial_wires; // State of the wires at the current hadamard
+  term_schedule schedule(terms, phase_expts, n + h); // Which terms we still have to partition
+  int dim = n, tmp1, tmp2, tdepth = 0, h_count = 1, applied = 0, j, num_init = 0;
+  ind_oracle oracle(n + m, dim, n + h, &terms);
   gatelist circ;
   list<Hadamard>::iterator it;
+  restart_term_order();
 
   // initialize the wires
-  for (int i = 0, j = 0; i < n + m; i++) {
+  for (int i = 0; i < n + m; i++) {
     wires.push_back(xor_func(n + h));
     if (!zero[i]) {
-      wires[i].set(j);
-      mask.set(j++);
+      wires[i].set(num_init++);
     }
   }
-
-  // initialize the remaining list
-  for (const auto& xpt : phase_expts) {
-    if (xpt.second % 2 == 1) remaining[0].push_back(xpt.first);
-    else if (xpt.second != 0) remaining[1].push_back(xpt.first);
-  }
+  rank_tracker wire_rank(wires);   // Rank of the current wires
 
   // create an initial partition
   // cerr << "Adding new functions to the partition... " << flush;
   for (int j = 0; j < 2; j++) {
-    for (auto it = remaining[j].begin(); it != remaining[j].end();) {
-      if (mask.contains(*it)) {
-        add_to_partition(floats[j], *it, oracle);
-        it = remaining[j].erase(it);
-      } else it++;
-    }
+    partition_available(floats[j], schedule.release(j, -1, num_init), terms, oracle,
+        caches[j], hadamards.begin(), hadamards.end());
   }
-  if (disp_log) cerr << "  " << phase_expts.size() - (remaining[0].size() + remaining[1].size())
+  if (disp_log) cerr << "  " << phase_expts.size() - schedule.remaining
     << "/" << phase_expts.size() << " phase rotations partitioned\n" << flush;
 
   for (auto it = hadamards.begin(); it != hadamards.end(); it++, h_count++) {
@@ -458,8 +634,9 @@ dotqc character::synthesize_unbounded() {
     // 3. apply the hadamard gate
     // 4. add new functions to the partition
     if (disp_log) cerr << "  Hadamard " << h_count << "/" << hadamards.size() << "\n" << flush;
+    it->replay(snapshot);
 
-    tmp1 = compute_rank(n + m, n + h, wires);
+    tmp1 = wire_rank.rank();
     // determine frozen partitions
     for (j = 0; j < 2; j++) {
       frozen[j] = freeze_partitions(floats[j], it->in);
@@ -467,11 +644,13 @@ dotqc character::synthesize_unbounded() {
       // determine if we need to add ancillae
       if (frozen[j].size() != 0) {
           // TODO audit
-        tmp2 = compute_rank(*(frozen[j].begin()));
+        tmp2 = terms.rank(*(frozen[j].begin()));
         int etc = ((tmp1 - tmp2 < 0)?tmp1:tmp1 - tmp2) + num_elts(frozen[j]) - n - m;
         if (etc > 0) {
           for (int i = n + m; i < n + m + etc; i++) {
             wires.push_back(xor_func(n + h));
+            snapshot.push_back(xor_func(n + h));
+            wire_rank.add_row();
           }
           this->add_ancillae(etc);
         }
@@ -480,34 +659,35 @@ dotqc character::synthesize_unbounded() {
 
     if (disp_log) cerr << "    Synthesizing T-layer\n" << flush;
     // Construct {CNOT, T} subcircuit for the frozen partitions
-    ret.circ.splice(ret.circ.end(),
-        construct_circuit(phase_expts, frozen[0], wires, wires, n + m, n + h, names));
-    ret.circ.splice(ret.circ.end(),
-        construct_circuit(phase_expts, frozen[1], wires, it->wires, n + m, n + h, names));
+    const layer_context ctx(wires, n + m, n + h);
+    append_gates(ret.circ,
+        construct_circuit(terms, phase_expts, frozen[0], ctx, wires, n + m, n + h));
+    append_gates(ret.circ,
+        construct_circuit(terms, phase_expts, frozen[1], ctx, snapshot, n + m, n + h));
     for (int i = 0; i < n + m; i++) {
-      wires[i] = it->wires[i];
+      wires[i] = snapshot[i];
+    }
+    for (const auto & change : it->changes) {
+      wire_rank.replace(change.first, change.second);
     }
     if (disp_log) cerr << "    " << applied << "/" << phase_expts.size() << " phase rotations applied\n" << flush;
 
     // Apply Hadamard gate
-    ret.circ.push_back(make_pair("H", list<string>(1, names[it->qubit])));
+    ret.circ.push_back(gate(gate_type::H, {it->qubit}));
     wires[it->qubit].reset();
     wires[it->qubit].set(it->prep);
-    mask.set(it->prep);
+    wire_rank.replace(it->qubit, wires[it->qubit]);
 
     // Add new functions to the partition
     for (int j = 0; j < 2; j++) {
-      for (auto it = remaining[j].begin(); it != remaining[j].end();) {
-        if (mask.contains(*it)) {
-          if (floats[j].size() == 0) {
-              floats[j].push_back(set<xor_func>());
-          }
-          (floats[j].begin())->insert(*it);
-          it = remaining[j].erase(it);
-        } else it++;
+      for (const term_id id : schedule.release(j, it->prep, it->prep + 1)) {
+        if (floats[j].size() == 0) {
+            floats[j].push_back(term_set());
+        }
+        (floats[j].begin())->insert(id);
       }
     }
-    if (disp_log) cerr << "    " << phase_expts.size() - (remaining[0].size() + remaining[1].size())
+    if (disp_log) cerr << "    " << phase_expts.size() - schedule.remaining
       << "/" << phase_expts.size() << " phase rotations partitioned\n" << flush;
   }
 
@@ -515,30 +695,30 @@ dotqc character::synthesize_unbounded() {
   // Construct the final {CNOT, T} subcircuit
 
   // determine if we need to add ancillae
-  tmp1 = compute_rank(n + m, n + h, wires);
+  tmp1 = wire_rank.rank();
   for (j = 0; j < 2; j++) {
     if (floats[j].size() != 0) {
-      for (j = 0; j < 2; j++) {
-          // TODO audit
-        tmp2 = compute_rank(*(floats[j].begin()));
-        int etc = tmp1 - tmp2 + num_elts(floats[j]) - n - m;
-        if (etc > 0) {
-          if (disp_log) cerr << "    " << "Adding " << etc << " ancilla(e)\n" << flush;
-          for (int i = n + m; i < n + m + etc; i++) {
-            wires.push_back(xor_func(n + h));
-          }
-          this->add_ancillae(etc);
+        // TODO audit
+      tmp2 = terms.rank(*(floats[j].begin()));
+      int etc = tmp1 - tmp2 + num_elts(floats[j]) - n - m;
+      if (etc > 0) {
+        if (disp_log) cerr << "    " << "Adding " << etc << " ancilla(e)\n" << flush;
+        for (int i = n + m; i < n + m + etc; i++) {
+          wires.push_back(xor_func(n + h));
         }
+        this->add_ancillae(etc);
       }
     }
   }
 
-  ret.circ.splice(ret.circ.end(),
-      construct_circuit(phase_expts, floats[0],
-          wires, wires, n + m, n + h, names));
-  ret.circ.splice(ret.circ.end(),
-      construct_circuit(phase_expts, floats[1],
-          wires, this->outputs, n + m, n + h, names));
+  const layer_context ctx(wires, n + m, n + h);
+  append_gates(ret.circ,
+      construct_circuit(terms, phase_expts, floats[0],
+          ctx, wires, n + m, n + h));
+  append_gates(ret.circ,
+      construct_circuit(terms, phase_expts, floats[1],
+          ctx, this->outputs, n + m, n + h));
+  relabel_swaps(ret.circ, n + m);
   if (disp_log) cerr << "  " << applied << "/" << phase_expts.size() << " phase rotations applied\n" << flush;
 
   ret.n = n;
@@ -673,3 +853,20 @@ void metacircuit::optimize() {
   }
 }
 */
+
+//---------------------------- Independent regions
+
+dotqc synthesize_regions(const dotqc & input, const vector<dotqc> & regions) {
+  vector<dotqc> synths(regions.size());
+
+  // The regions share the workers with their own layers and partitions, so
+  //   however few regions there are, every thread has work
+  shared_workers().run(regions.size(), [&regions, &synths](size_t i) {
+    character c{regions[i]};
+    if (disp_log) cerr << "  Region " << i + 1 << ": " << c.n + c.m << " qubits, "
+      << c.hadamards.size() << " hadamards\n" << flush;
+    synths[i] = c.synthesize();
+  });
+
+  return input.merge_regions(synths);
+}
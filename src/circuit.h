@@ -30,15 +30,56 @@ Author: Matthew Amy
 
 #include "matroid.h"
 #include "util.h"
+#include "term_table.h"
 #include "dotqc.h"
 
+// Threads character::synthesize may use to build {CNOT, T} layers while it
+//   partitions the next ones. With 0 they're built in line
+extern int layer_workers;
+
 // ------------------------- Hadamard version
 struct Hadamard {
   int qubit;        // Which qubit this hadamard is applied to
   int prep;         // Which "value" this hadamard prepares
 
-  std::set<xor_func> in;      // exponent terms that must be prepared before the hadamard
-  std::vector<xor_func> wires; // state of the wires when this hadamard is applied
+  term_set in;                 // exponent terms that must be prepared before the hadamard
+  // Wires that changed since the previous hadamard (or the start of the
+  //   circuit). Replaying these in order gives the state of the wires when
+  //   each hadamard is applied, without storing a full copy per hadamard
+  std::vector<std::pair<int, xor_func>> changes;
+
+  // Bring wires from the state at the previous hadamard up to this one
+  void replay(std::vector<xor_func> & wires) const {
+    for (const auto & change : changes) wires[change.first] = change.second;
+  }
+};
+
+// Builds a character one gate at a time, so a circuit can be parsed straight
+//   into it without keeping its gatelist (see dotqc::input_gate). The number
+//   of hadamards isn't known until the end, so there's room for the values
+//   of expected_h of them at first, doubled whenever it runs out
+class character_builder {
+  friend struct character;
+
+  int n, m, h = 0;
+  int width;                          // bits in each xor_func so far
+  std::vector<std::string> names;
+  std::vector<bool> zero;
+  std::map<int, int> val_map;
+  term_table terms;
+  std::vector<exponent_val> phase_expts;
+  std::vector<xor_func> wires;        // current state of the wires
+  std::vector<xor_func> last_wires;   // state at the previous hadamard
+  std::vector<xor_func> initial_wires;
+  std::list<Hadamard> hadamards;
+  std::vector<term_table::block> scratch; // rows for insert_ccz_phase
+  int val_max = 0, name_max = 0, gate_index = -1;
+
+  void grow();
+public:
+  // Takes the qubits from header and ignores its gates
+  explicit character_builder(const dotqc & header, int expected_h = 0);
+  void add_gate(const gate & g);
 };
 
 // Characteristic of a circuit
@@ -49,19 +90,31 @@ struct character {
   std::vector<std::string>   names;  // names of qubits
   std::vector<bool>     zero;        // Which qubits start as 0
   std::map<int, int>    val_map;     // which value corresponds to which qubit
-  exponents_set         phase_expts; // a list of exponents of \omega in the mapping
+  term_table            terms;       // every phase term, ids in xor_func order
+  std::vector<exponent_val> phase_expts; // exponent of \omega for each term id
   std::vector<xor_func> outputs;     // the xors computed into each qubit
+  std::vector<xor_func> initial_wires; // state of the wires before the first gate
   // TODO: make this a dependency graph instead
   std::list<Hadamard>   hadamards;   // a list of the hadamards in the order we saw them
   character(const dotqc &input);
+  explicit character(character_builder && builder);
   void output(std::ostream& out) const;
   void print() {output(std::cout);}
   void print_outputs() const;
   void add_ancillae(int num);
+  // A circuit on the qubits of the character, with no gates yet
+  dotqc empty_circuit() const;
   dotqc synthesize();
+  // Passes the gates of the synthesized circuit to out as they're made,
+  //   rather than keeping them
+  void synthesize(gate_sink out);
   dotqc synthesize_unbounded();
 };
 
+// Synthesizes each region of the circuit (see dotqc::split_independent) as
+//   its own character, on the shared workers, and interleaves the results
+dotqc synthesize_regions(const dotqc & input, const std::vector<dotqc> & regions);
+
 // ------------------------- {CNOT, T} version
 /*
 enum circuit_type { CNOTT, OTHER, UNKNOWN };
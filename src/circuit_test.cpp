@@ -1,5 +1,6 @@
 #include "circuit.h"
 #include "util.h"
+#include "partition.h"
 
 #include <gtest/gtest.h>
 
@@ -14,7 +15,7 @@ TEST(parsingFromDotQC, initalized) {
         .zero = {{"1", false}},
         .input_wires = {},
         .output_wires = {},
-        .circ = {{"Z", {"1"} }}
+        .circ = {gate(gate_type::Z, {0})}
     };
     character c{input_dotqc};
     EXPECT_EQ(1, c.n);
@@ -76,3 +77,102 @@ TEST(character, insertPhaseMap) {
     insert_phase(6, f0101, xpt);
     EXPECT_EQ(0, xpt[f0101]);  // TODO is that expected?
 }
+
+TEST(character, cczPhase) {
+    dotqc input_dotqc {.n = 3, .m = 0,
+        .names = {"A", "B", "C"},
+        .zero = {{"A", false}, {"B", false}, {"C", false}},
+        .input_wires = {"A", "B", "C"},
+        .output_wires = {"A", "B", "C"},
+        .circ = {gate(gate_type::Z, {0, 1, 2})}
+    };
+    character c{input_dotqc};
+    ASSERT_EQ(7, c.phase_expts.size());
+    int ones = 0, sevens = 0;
+    for (term_id id = 0; id < c.terms.size(); id++) {
+        if (c.phase_expts[id] == 1) ones++;
+        if (c.phase_expts[id] == 7) sevens++;
+        if (c.terms.weight(id) == 2) {
+            EXPECT_EQ(7, c.phase_expts[id]);
+        }
+    }
+    EXPECT_EQ(4, ones);
+    EXPECT_EQ(3, sevens);
+
+    // Terms that cancel out are dropped
+    input_dotqc.circ = {gate(gate_type::T, {0}), gate(gate_type::TOF, {0, 1}),
+        gate(gate_type::T, {1}), gate(gate_type::T_DAG, {0})};
+    character cancelled{input_dotqc};
+    EXPECT_EQ(1, cancelled.phase_expts.size());
+    EXPECT_EQ(1, cancelled.terms.size());
+    EXPECT_EQ(2, cancelled.terms.weight(0));
+}
+
+TEST(character, builderGrows) {
+    dotqc input_dotqc {.n = 2, .m = 0,
+        .names = {"A", "B"},
+        .zero = {{"A", false}, {"B", false}},
+        .input_wires = {"A", "B"},
+        .output_wires = {"A", "B"},
+        .circ = {}
+    };
+    for (int i = 0; i < 20; i++) {
+        input_dotqc.circ.push_back(gate(gate_type::T, {0}));
+        input_dotqc.circ.push_back(gate(gate_type::TOF, {0, 1}));
+        input_dotqc.circ.push_back(gate(gate_type::H, {0}));
+    }
+    character whole{input_dotqc};
+
+    // With no room for any hadamards at first
+    character_builder builder(input_dotqc);
+    for (const auto& g : input_dotqc.circ) builder.add_gate(g);
+    character streamed{move(builder)};
+
+    EXPECT_EQ(whole.h, streamed.h);
+    EXPECT_EQ(whole.names, streamed.names);
+    EXPECT_EQ(whole.phase_expts, streamed.phase_expts);
+    ASSERT_EQ(whole.terms.size(), streamed.terms.size());
+    for (term_id id = 0; id < whole.terms.size(); id++) {
+        EXPECT_EQ(whole.terms[id], streamed.terms[id]);
+    }
+    EXPECT_EQ(whole.initial_wires, streamed.initial_wires);
+    ASSERT_EQ(whole.hadamards.size(), streamed.hadamards.size());
+    auto it = streamed.hadamards.begin();
+    for (const Hadamard & had : whole.hadamards) {
+        EXPECT_EQ(had.in, it->in);
+        EXPECT_EQ(had.changes, it->changes);
+        it++;
+    }
+}
+
+TEST(character, synthesizeToSink) {
+    dotqc input_dotqc {.n = 3, .m = 0,
+        .names = {"A", "B", "C"},
+        .zero = {{"A", false}, {"B", false}, {"C", false}},
+        .input_wires = {"A", "B", "C"},
+        .output_wires = {"A", "B", "C"},
+        .circ = {gate(gate_type::H, {2}), gate(gate_type::TOF, {1, 2}),
+            gate(gate_type::T_DAG, {2}), gate(gate_type::TOF, {0, 2}),
+            gate(gate_type::T, {2}), gate(gate_type::TOF, {1, 2}),
+            gate(gate_type::T_DAG, {2}), gate(gate_type::TOF, {0, 2}),
+            gate(gate_type::T, {1}), gate(gate_type::T, {2}),
+            gate(gate_type::H, {2}), gate(gate_type::TOF, {0, 1}),
+            gate(gate_type::T, {0}), gate(gate_type::T_DAG, {1}),
+            gate(gate_type::TOF, {0, 1})}
+    };
+    // Random orders go on from where the last synthesis left them
+    const order_type order = term_order;
+    term_order = ORDER_NATURAL;
+    character c{input_dotqc};
+    const dotqc kept = c.synthesize();
+    gatelist streamed;
+    c.synthesize([&streamed](const gate & g) { streamed.push_back(g); });
+    term_order = order;
+
+    ASSERT_FALSE(kept.circ.empty());
+    EXPECT_EQ(kept.circ, streamed);
+    dotqc empty = c.empty_circuit();
+    EXPECT_EQ(kept.names, empty.names);
+    EXPECT_EQ(kept.zero, empty.zero);
+    EXPECT_TRUE(empty.circ.empty());
+}
@@ -0,0 +1,85 @@
+#include <boost/functional/hash.hpp>
+
+#include "cnot_cache.h"
+#include "stats.h"
+
+using namespace std;
+
+size_t cnot_cache::key_hash::operator()(const vector<block> & key) const {
+  return boost::hash_range(key.begin(), key.end());
+}
+
+// The method and the number of rows, then each row's length, negation and
+//   bits
+vector<cnot_cache::block> cnot_cache::make_key(int method, const vector<xor_func> & mat) {
+  vector<block> key = {(block)method, (block)mat.size()};
+  for (const xor_func & row : mat) {
+    key.push_back(row.size());
+    key.push_back(row.is_negated());
+    size_t start = key.size();
+    key.resize(start + row.num_blocks());
+    row.to_blocks(key.begin() + start);
+  }
+  return key;
+}
+
+gatelist cnot_cache::synthesize(int method, const vector<xor_func> & mat,
+    synthesizer synth, string * name) {
+  vector<xor_func> bits = mat;
+  string synth_name;
+  {
+    lock_guard<mutex> guard(lock);
+    if (capacity == 0) {
+      gatelist gates = synth(bits, synth_name);
+      if (name) *name = synth_name;
+      return gates;
+    }
+  }
+
+  vector<block> key = make_key(method, mat);
+  {
+    lock_guard<mutex> guard(lock);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+      local_stats().cnot_cache_hits++;
+      if (name) *name = it->second.name;
+      return it->second.gates;
+    }
+  }
+
+  local_stats().cnot_cache_misses++;
+  gatelist gates = synth(bits, synth_name);
+  if (name) *name = synth_name;
+
+  lock_guard<mutex> guard(lock);
+  if (capacity != 0) {
+    auto ins = entries.emplace(move(key), entry{gates, synth_name});
+    if (ins.second) {
+      order.push_back(&ins.first->first);
+      while (entries.size() > capacity) {
+        entries.erase(*order.front());
+        order.pop_front();
+      }
+    }
+  }
+  return gates;
+}
+
+void cnot_cache::set_capacity(size_t capacity) {
+  lock_guard<mutex> guard(lock);
+  this->capacity = capacity;
+  while (entries.size() > capacity) {
+    entries.erase(*order.front());
+    order.pop_front();
+  }
+}
+
+size_t cnot_cache::size() {
+  lock_guard<mutex> guard(lock);
+  return entries.size();
+}
+
+cnot_cache & cnot_memo() {
+  static cnot_cache memo(4096);
+  return memo;
+}
@@ -0,0 +1,53 @@
+#ifndef CNOT_CACHE_H
+#define CNOT_CACHE_H
+
+#include <vector>
+#include <string>
+#include <deque>
+#include <mutex>
+#include <functional>
+#include <unordered_map>
+
+#include "types.h"
+#include "xor_func.h"
+
+// Linear reversible circuits already synthesized, keyed on the method and
+//   the matrix, negations included. Gates name wires by index, so a
+//   transformation that comes up again on any qubits is synthesized once,
+//   whatever they're called. Holds at most capacity
+//   circuits, forgetting the oldest first. Safe to share between threads.
+class cnot_cache {
+  public:
+    using block = boost::dynamic_bitset<>::block_type;
+    // Synthesizes the matrix, mutating it. May name the method that gave
+    //   the circuit, for the statistics
+    using synthesizer = std::function<gatelist(std::vector<xor_func> &, std::string & name)>;
+  private:
+    struct key_hash {
+      size_t operator()(const std::vector<block> & key) const;
+    };
+    struct entry {
+      gatelist gates;
+      std::string name;
+    };
+    size_t capacity;
+    std::mutex lock;
+    std::unordered_map<std::vector<block>, entry, key_hash> entries;
+    std::deque<const std::vector<block> *> order;   // keys, oldest first
+
+    static std::vector<block> make_key(int method, const std::vector<xor_func> & mat);
+  public:
+    explicit cnot_cache(size_t capacity) : capacity(capacity) {}
+
+    // synth(mat), or the same gates from the last time mat was synthesized
+    //   by method. Either way, name is set to what synth named them
+    gatelist synthesize(int method, const std::vector<xor_func> & mat,
+        synthesizer synth, std::string * name = nullptr);
+
+    void set_capacity(size_t capacity);
+    size_t size();
+};
+
+// The cache construct_circuit synthesizes through
+cnot_cache & cnot_memo();
+#endif // CNOT_CACHE_H
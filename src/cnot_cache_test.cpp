@@ -0,0 +1,82 @@
+#include <gtest/gtest.h>
+
+#include "cnot_cache.h"
+#include "stats.h"
+
+using namespace std;
+
+gatelist CNOT_synth(int n, vector<xor_func>& bits);
+
+static cnot_cache::synthesizer pmh(int n, int & calls) {
+    return [n, &calls](vector<xor_func> & bits, string &) {
+        calls++;
+        return CNOT_synth(n, bits);
+    };
+}
+
+TEST(cnotCache, hits) {
+    cnot_cache cache(8);
+    vector<xor_func> mat = {
+        {false, {1,1,0}},
+        {false, {0,1,0}},
+        {false, {0,1,1}},
+    };
+    int calls = 0;
+    const partition_stats before = local_stats();
+
+    vector<xor_func> tmp = mat;
+    gatelist expected = CNOT_synth(3, tmp);
+
+    EXPECT_EQ(expected, cache.synthesize(0, mat, pmh(3, calls)));
+    EXPECT_EQ(expected, cache.synthesize(0, mat, pmh(3, calls)));
+    EXPECT_EQ(1, calls);
+    EXPECT_EQ(1, local_stats().cnot_cache_hits - before.cnot_cache_hits);
+    EXPECT_EQ(1, local_stats().cnot_cache_misses - before.cnot_cache_misses);
+
+    // Another method or negation is another entry
+    cache.synthesize(1, mat, pmh(3, calls));
+    mat[1].negate();
+    cache.synthesize(0, mat, pmh(3, calls));
+    EXPECT_EQ(3, calls);
+    EXPECT_EQ(3, cache.size());
+}
+
+TEST(cnotCache, names) {
+    cnot_cache cache(8);
+    vector<xor_func> mat = {{false, {1,1}}, {false, {0,1}}};
+    auto named = [](vector<xor_func> & bits, string & name) {
+        name = "PMH2";
+        return CNOT_synth(2, bits);
+    };
+
+    // A hit gives the name the circuit was synthesized under
+    string name;
+    cache.synthesize(0, mat, named, &name);
+    EXPECT_EQ("PMH2", name);
+    name.clear();
+    cache.synthesize(0, mat, named, &name);
+    EXPECT_EQ("PMH2", name);
+}
+
+TEST(cnotCache, bounded) {
+    cnot_cache cache(2);
+    int calls = 0;
+    vector<vector<xor_func>> mats = {
+        {{false, {1,0}}, {false, {1,1}}},
+        {{false, {1,1}}, {false, {0,1}}},
+        {{false, {0,1}}, {false, {1,0}}},
+    };
+    for (auto& mat : mats) cache.synthesize(0, mat, pmh(2, calls));
+    EXPECT_EQ(2, cache.size());
+
+    // The oldest was forgotten
+    cache.synthesize(0, mats[2], pmh(2, calls));
+    EXPECT_EQ(3, calls);
+    cache.synthesize(0, mats[0], pmh(2, calls));
+    EXPECT_EQ(4, calls);
+
+    cache.set_capacity(0);
+    EXPECT_EQ(0, cache.size());
+    cache.synthesize(0, mats[0], pmh(2, calls));
+    EXPECT_EQ(5, calls);
+}
@@ -1,5 +1,8 @@
 #include "dotqc.h"
 #include "util.h"
+
+#include <set>
+#include <functional>
 //----------------------------------------- DOTQC stuff
 
 using namespace std;
@@ -8,10 +11,39 @@ void ignore_white(istream& in) {
   while (in.peek() == ' ' || in.peek() == ';') in.ignore();
 }
 
+static const char * const gate_names[] = {"H", "X", "Y", "Z", "P", "P*", "T", "T*", "tof", "swap"};
+
+const char * gate_name(gate_type type) {
+  return gate_names[(int)type];
+}
+
+bool parse_gate_type(const string & name, gate_type & type) {
+  if (name == "TOF") return parse_gate_type("tof", type);
+  for (int i = 0; i <= (int)gate_type::TOF; i++) {
+    if (name == gate_names[i]) {
+      type = (gate_type)i;
+      return true;
+    }
+  }
+  return false;
+}
+
 void dotqc::input(istream& in) {
-  int i, j;
-  string buf, tmp;
-  list<string> namelist;
+  gate g;
+
+  input_header(in);
+  const auto index = name_index();
+  while (input_gate(in, index, g)) circ.push_back(g);
+}
+
+unordered_map<string, int> dotqc::name_index() const {
+  unordered_map<string, int> ret;
+  for (size_t i = 0; i < names.size(); i++) ret[names[i]] = i;
+  return ret;
+}
+
+void dotqc::input_header(istream& in) {
+  string buf;
   n = 0;
 
   // Inputs
@@ -49,36 +81,53 @@ void dotqc::input(istream& in) {
 
   // Circuit
   while (buf != "BEGIN") in >> buf;
+}
+
+bool dotqc::input_gate(istream& in, const unordered_map<string, int> & index,
+    gate & g) const {
+  string buf, tmp;
+
   in >> tmp;
-  while (tmp != "END") {
-    namelist.clear();
-    // Build up a list of the applied qubits
-    ignore_white(in);
-    while (in.peek() != '\n' && in.peek() != '\r' && in.peek() != ';') {
-      in >> buf;
-      int pos = buf.find(';');
-      if (pos != string::npos) {
-        for (int i = buf.length() - 1; i > pos; i--) {
-          in.putback(buf[i]);
-        }
-        in.putback('\n');
-        buf.erase(pos, buf.length() - pos);
-      }
-      if (find(names.begin(), names.end(), buf) == names.end()) {
-        cout << "ERROR: no such qubit \"" << buf << "\"\n" << flush;
-        exit(1);
-      } else {
-        namelist.push_back(buf);
+  if (!in || tmp == "END") return false;
+  g = gate();
+  if (!parse_gate_type(tmp, g.type)) {
+    cout << "ERROR: no such gate \"" << tmp << "\"\n" << flush;
+    exit(1);
+  }
+  // Build up a list of the applied qubits
+  ignore_white(in);
+  while (in.peek() != '\n' && in.peek() != '\r' && in.peek() != ';') {
+    in >> buf;
+    int pos = buf.find(';');
+    if (pos != string::npos) {
+      for (int i = buf.length() - 1; i > pos; i--) {
+        in.putback(buf[i]);
       }
-      ignore_white(in);
+      in.putback('\n');
+      buf.erase(pos, buf.length() - pos);
     }
-    if (tmp == "TOF") tmp = "tof";
-    circ.push_back(make_pair(tmp, namelist));
-    in >> tmp;
+    auto it = index.find(buf);
+    if (it == index.end()) {
+      cout << "ERROR: no such qubit \"" << buf << "\"\n" << flush;
+      exit(1);
+    } else if (g.size == 3) {
+      cout << "ERROR: too many qubits for gate \"" << tmp << "\"\n" << flush;
+      exit(1);
+    } else {
+      g.wires[g.size++] = it->second;
+    }
+    ignore_white(in);
   }
+  return true;
 }
 
 void dotqc::output(ostream& out) const {
+  output_header(out);
+  for (const auto& g : circ) output_gate(out, g);
+  out << "END\n";
+}
+
+void dotqc::output_header(ostream& out) const {
   // Inputs
   out << ".v";
   for (auto name_it = names.begin(); name_it != names.end(); name_it++) {
@@ -99,22 +148,22 @@ void dotqc::output(ostream& out) const {
 
   // Circuit
   out << "\n\nBEGIN\n";
-  for (auto it = circ.begin(); it != circ.end(); it++) {
-    out << it->first;
-    for (auto ti = (it->second).begin(); ti != (it->second).end(); ti++) {
-      out << " " << *ti;
-    }
-    out << "\n";
+}
+
+void dotqc::output_gate(ostream& out, const gate & g) const {
+  out << gate_name(g.type);
+  for (int q : g) {
+    out << " " << names[q];
   }
-  out << "END\n";
+  out << "\n";
 }
 
-int max_depth(const map<string, int> & depths, const list<string> & names) {
+int max_depth(const vector<int> & depths, const gate & g) {
   int max = 0;
 
-  for (const auto& name : names) {
-      if (depths.at(name) > max) {
-          max = depths.at(name);
+  for (int q : g) {
+      if (depths.at(q) > max) {
+          max = depths.at(q);
       }
   }
 
@@ -123,72 +172,74 @@ int max_depth(const map<string, int> & depths, const list<string> & names) {
 
 // Compute T-depth
 int dotqc::count_t_depth() const {
-  map<string, int> current_t_depth;
+  vector<int> current_t_depth(names.size(), 0);
   int d;
 
-  for (const auto& name : names) {
-    current_t_depth[name] = 0;
-  }
-
   for (auto it = circ.rbegin(); it != circ.rend(); it++) {
-    d = max_depth(current_t_depth, it->second);
-    if ((it->first == "T") || (it->first == "T*")) {
+    d = max_depth(current_t_depth, *it);
+    if ((it->type == gate_type::T) || (it->type == gate_type::T_DAG)) {
       d = d + 1;
-    } else if ((it->first == "Z") && (it->second.size() >= 3)) {
+    } else if ((it->type == gate_type::Z) && (it->size >= 3)) {
       d = d + 3;
     }
-    for (const auto wire : it->second) {
-      current_t_depth[wire] = d;
+    for (int q : *it) {
+      current_t_depth[q] = d;
     }
   }
 
-  return max_depth(current_t_depth, names);
+  int ret = 0;
+  for (int depth : current_t_depth) ret = max(ret, depth);
+  return ret;
 }
 
-// Gather statistics and print
-void dotqc::print_stats() const {
-  int H = 0;
-  int cnot = 0;
-  int X = 0;
-  int T = 0;
-  int P = 0;
-  int Z = 0;
-  int tdepth = 0;
-  bool tlayer = false;
-  set<string> qubits;
-
-  for (const auto& gate : this->circ) {
-    // Add each on the inputs to the set of used qubits
-    for (const string& qubit : gate.second) {
-        qubits.insert(qubit);
+void gate_stats::add(const gate & g) {
+  // Add each on the inputs to the set of used qubits
+  for (int q : g) {
+      qubits.insert(q);
+  }
+  if (g.type == gate_type::T || g.type == gate_type::T_DAG) {
+    T++;
+    if (!tlayer) {
+      tlayer = true;
+      tdepth++;
     }
-    if (gate.first == "T" || gate.first == "T*") {
-      T++;
-      if (!tlayer) {
-        tlayer = true;
-        tdepth++;
-      }
-    } else if (gate.first == "P" || gate.first == "P*") {
-        P++;
-    } else if (gate.first == "Z" && gate.second.size() == 3) {
-      tdepth += 3;
-      T += 7;
-      cnot += 7;
-    } else if (gate.first == "Z") {
-        Z++;
-    } else {
-      tlayer = false;
-      if (gate.first == "tof" && gate.second.size() == 2) {
-          cnot++;
-      } else if (gate.first == "tof" || gate.first == "X") {
-          X++;
-      } else if (gate.first == "H") {
-          H++;
-      }
+  } else if (g.type == gate_type::P || g.type == gate_type::P_DAG) {
+      P++;
+  } else if (g.type == gate_type::Z && g.size == 3) {
+    tdepth += 3;
+    T += 7;
+    cnot += 7;
+  } else if (g.type == gate_type::Z) {
+      Z++;
+  } else {
+    tlayer = false;
+    if (g.type == gate_type::TOF && g.size == 2) {
+        cnot++;
+    } else if (g.type == gate_type::TOF || g.type == gate_type::X) {
+        X++;
+    } else if (g.type == gate_type::H) {
+        H++;
     }
   }
 
-  cout << "#   qubits: " << names.size() << "\n";
+  // The longest path is the same in either direction, so the critical path
+  //   is followed forwards here rather than backwards as in count_t_depth
+  int d = 0;
+  for (int q : g) {
+    if ((size_t)q >= path_depth.size()) path_depth.resize(q + 1, 0);
+    d = max(d, path_depth[q]);
+  }
+  if (g.type == gate_type::T || g.type == gate_type::T_DAG) {
+    d = d + 1;
+  } else if (g.type == gate_type::Z && g.size >= 3) {
+    d = d + 3;
+  }
+  for (int q : g) path_depth[q] = d;
+  critical_depth = max(critical_depth, d);
+}
+
+void gate_stats::print(size_t num_qubits) const {
+  cout << "#   qubits: " << num_qubits << "\n";
   cout << "#   qubits used: " << qubits.size() << "\n";
   cout << "#   H: " << H << "\n";
   cout << "#   cnot: " << cnot << "\n";
@@ -197,8 +248,15 @@ void dotqc::print_stats() const {
   cout << "#   P: " << P << "\n";
   cout << "#   Z: " << Z << "\n";
   cout << "#   tdepth (by partitions): " << tdepth << "\n";
-  cout << "#   tdepth (by critical paths): " << count_t_depth() << "\n";
+  cout << "#   tdepth (by critical paths): " << critical_depth << "\n";
+}
+
+// Gather statistics and print
+void dotqc::print_stats() const {
+  gate_stats stats;
 
+  for (const auto& gate : this->circ) stats.add(gate);
+  stats.print(names.size());
 }
 
 // Count the Hadamard gates
@@ -206,149 +264,140 @@ int dotqc::count_h() const {
   int ret = 0;
 
   for (const auto& gate : this->circ) {
-    if (gate.first == "H") ret++;
+    if (gate.type == gate_type::H) ret++;
   }
 
   return ret;
 }
 
-void dotqc::append(pair<string, list<string> > gate) {
-  circ.push_back(gate);
+// Optimizations
+static bool is_cnot(const gate & g, int target, int control) {
+  return g.type == gate_type::TOF && g.size == 2
+    && g.wires[0] == target && g.wires[1] == control;
+}
 
-  for (const string& wire : gate.second) {
-    // If it's already not in, add it
-    if (find(names.begin(), names.end(), wire) == names.end()) {
-        names.push_back(wire);
-    }
-  }
+swap_filter::swap_filter(const vector<string> & names, function<void(const gate &)> emit) :
+  names(names),
+  emit(emit),
+  perm(names.size()),
+  moved(names.size(), false)
+{
+  for (size_t q = 0; q < perm.size(); q++) perm[q] = q;
 }
 
-// Optimizations
-// TODO audit this
-void dotqc::remove_swaps() {
-  gatelist::iterator it, tt, ttt;
-  list<string>::iterator iti;
-  map<string, string>::iterator pit;
-  string q1, q2, q1_map, q2_map, tmp;
-  bool flg, found_q1, found_q2;
-  int i;
-  map<string, string> perm;
-
-  for (it = circ.begin(), i = 0; i < (circ.size() - 3);) {
-    flg = false;
-    if (it->first == "tof" && it->second.size() == 2) {
-      iti = it->second.begin();
-      q1 = *(iti++);
-      q2 = *iti;
-
-      tt = it;
-      tt++;
-      ttt = tt;
-      ttt++;
-      if (tt->first == "tof" && tt->second.size() == 2 && ttt->first == "tof" && ttt->second.size() == 2) {
-        flg = true;
-        iti = tt->second.begin();
-        flg &= *(iti++) == q2;
-        flg &= *(iti) == q1;
-        iti = ttt->second.begin();
-        flg &= *(iti++) == q1;
-        flg &= *(iti) == q2;
-
-        if (flg) {
-          circ.erase(it);
-          circ.erase(tt);
-          it = circ.erase(ttt);
-          found_q1 = found_q2 = false;
-          q1_map = (perm.find(q2) != perm.end()) ? perm[q2] : q2;
-          q2_map = (perm.find(q1) != perm.end()) ? perm[q1] : q1;
-          perm[q1] = q1_map;
-          perm[q2] = q2_map;
-        }
-      }
-    }
-    if (!flg) {
-      // Apply permutation
-      for (iti = it->second.begin(); iti != it->second.end(); iti++) {
-        if (perm.find(*iti) != perm.end()) *iti = perm[*iti];
-      }
-      i++;
-      it++;
+void swap_filter::pop() {
+  const gate & g = pending[0];
+  if (g.type == gate_type::TOF && g.size == 2) {
+    int q1 = g.wires[0], q2 = g.wires[1];
+    if (is_cnot(pending[1], q2, q1) && is_cnot(pending[2], q1, q2)) {
+      swap(perm[q1], perm[q2]);
+      moved[q1] = moved[q2] = true;
+      pending.erase(pending.begin(), pending.begin() + 3);
+      return;
     }
   }
-  for (; i < circ.size(); i++) {
-    for (iti = it->second.begin(); iti != it->second.end(); iti++) {
-      if (perm.find(*iti) != perm.end()) *iti = perm[*iti];
-    }
-    it++;
+  // Apply permutation
+  gate out = g;
+  for (int & q : out) q = perm[q];
+  emit(out);
+  pending.pop_front();
+}
+
+void swap_filter::push(const gate & g) {
+  pending.push_back(g);
+  // Only swaps followed by some other gate are taken out
+  if (pending.size() > 3) pop();
+}
+
+void swap_filter::flush() {
+  for (auto g : pending) {
+    for (int & q : g) q = perm[q];
+    emit(g);
   }
+  pending.clear();
 
-  // fix outputs
-  while(!perm.empty()) {
-    pit = perm.begin();
-    if (pit->first == pit->second) perm.erase(pit);
+  // fix outputs, in order of name
+  map<string, int> pending_names;
+  for (size_t q = 0; q < perm.size(); q++) {
+    if (moved[q]) pending_names[names[q]] = perm[q];
+  }
+  while (!pending_names.empty()) {
+    auto pit = pending_names.begin();
+    if (names[pit->second] == pit->first) pending_names.erase(pit);
     else {
-      list<string> tmp_list1, tmp_list2;
-      q1 = pit->second;
-      q2 = perm[pit->second];
-      tmp_list1.push_back(q1);
-      tmp_list1.push_back(q2);
-      tmp_list2.push_back(q2);
-      tmp_list2.push_back(q1);
-      circ.push_back(make_pair("tof", tmp_list1));
-      circ.push_back(make_pair("tof", tmp_list2));
-      circ.push_back(make_pair("tof", tmp_list1));
+      int q1 = pit->second;
+      int q2 = pending_names[names[q1]];
+      emit(gate(gate_type::TOF, {q1, q2}));
+      emit(gate(gate_type::TOF, {q2, q1}));
+      emit(gate(gate_type::TOF, {q1, q2}));
 
       pit->second = q2;
-      perm[q1] = q1;
+      pending_names[names[q1]] = q1;
     }
   }
 }
 
+// TODO audit this
+void dotqc::remove_swaps() {
+  gatelist ret;
+  swap_filter swaps(names, [&ret](const gate & g) { ret.push_back(g); });
 
-void dotqc::remove_ids() {
+  ret.reserve(circ.size());
+  for (const auto& g : circ) swaps.push(g);
+  swaps.flush();
+  circ = move(ret);
+}
 
-  // Maps each gate to it's identity.
-  map<string, string> ids;
+static bool cancels(gate_type a, gate_type b) {
+  switch (a) {
+    case gate_type::TOF:
+    case gate_type::Z:
+    case gate_type::H:     return b == a;
+    case gate_type::P:     return b == gate_type::P_DAG;
+    case gate_type::P_DAG: return b == gate_type::P;
+    case gate_type::T:     return b == gate_type::T_DAG;
+    case gate_type::T_DAG: return b == gate_type::T;
+    default:               return false;
+  }
+}
 
-  ids["tof"] = "tof";
-  ids["Z"] = "Z";
-  ids["H"] = "H";
-  ids["P"] = "P*";
-  ids["P*"] = "P";
-  ids["T"] = "T*";
-  ids["T*"] = "T";
+void dotqc::remove_ids() {
+  // The gates still in the circuit, linked in order. Index circ.size() is
+  //   the end
+  const int end = circ.size();
+  vector<int> next(end), prev(end);
+  int head = 0;
+  for (int i = 0; i < end; i++) {
+    next[i] = i + 1;
+    prev[i] = i - 1;
+  }
+  // Unlinks a gate, returning the one after it
+  auto erase = [&](int i) {
+    if (prev[i] < 0) head = next[i];
+    else next[prev[i]] = next[i];
+    if (next[i] != end) prev[next[i]] = prev[i];
+    return next[i];
+  };
 
   // Was an operation performed which might open up new chances to optimize.
   bool modified = true;
-  const bool logging = false;
 
   while (modified) {
     modified = false;
-    for (auto it = this->circ.begin(); it != this->circ.end(); it++) {
-      if(logging) cout << "Looking at gate " << it->first << endl;
+    for (int it = head; it != end; it = next[it]) {
       bool flg = false;
-      gatelist::iterator ti = it;
-      ti++;
       // Peek forward, looking for
       // a gate with the same inputs
       // giving up when we see one with overlapping inputs.
       // Note that we don't care about the order of the inputs apart
       // from the first one.  That's because they are all control lines.
-      for (; ti != circ.end() && !flg; ti++) {
-        if(logging) cout << "Comparing with gate " << ti->first << endl;
-        if(logging) cout << "Which has wires at:";
-        for (const auto& w : it->second) {
-            if(logging) cout << " " << w;
-        }
-        if(logging) cout << endl;
-        const auto i = list_compare(it->second, ti->second);
-        switch (i) {
+      for (int ti = next[it]; ti != end && !flg; ti = next[ti]) {
+        switch (list_compare(circ[it], circ[ti])) {
             case list_compare_result::EQUAL:
-                if (ids[it->first] == ti->first
-                        && *(it->second.begin()) == *(ti->second.begin()) ) {
-                    if(logging) cout << "Inside if" << endl;
-                    ti = circ.erase(ti);
-                    it = circ.erase(it);
+                if (cancels(circ[it].type, circ[ti].type)
+                        && circ[it].wires[0] == circ[ti].wires[0]) {
+                    erase(ti);
+                    it = erase(it);
                     modified = true;
                 }
                 flg = true;
@@ -358,14 +407,48 @@ void dotqc::remove_ids() {
                 break;
             case list_compare_result::DISJOINT:
                 break;
-            default:
-                cerr << "Unknown result from list_compare" <<endl;
-                break;
         }
       }
+      // After a cancellation it is already the gate that followed, which
+      //   this pass then skips
+      if (it == end) break;
     }
   }
-  if(logging) cout << "DONE" << endl;
+
+  gatelist ret;
+  for (int it = head; it != end; it = next[it]) ret.push_back(circ[it]);
+  circ = move(ret);
+}
+
+identity_filter::identity_filter(size_t size, function<void(const gate &)> emit) :
+  size(size),
+  emit(emit)
+{ }
+
+// Looks back for the gate's inverse, as remove_ids does looking forwards,
+//   giving up at the first gate sharing some of its qubits
+void identity_filter::push(const gate & g) {
+  for (auto it = window.rbegin(); it != window.rend(); it++) {
+    const auto cmp = list_compare(*it, g);
+    if (cmp == list_compare_result::DISJOINT) continue;
+    if (cmp == list_compare_result::EQUAL && cancels(it->type, g.type)
+        && it->wires[0] == g.wires[0]) {
+      window.erase(next(it).base());
+      return;
+    }
+    break;
+  }
+
+  window.push_back(g);
+  if (window.size() > size) {
+    emit(window.front());
+    window.pop_front();
+  }
+}
+
+void identity_filter::flush() {
+  for (const auto& gate : window) emit(gate);
+  window.clear();
 }
 
 bool dotqc::operator==(const dotqc& other) const {
@@ -378,6 +461,106 @@ bool dotqc::operator==(const dotqc& other) const {
             && other.output_wires == output_wires);
 }
 
+vector<dotqc> dotqc::split_independent() const {
+  vector<int> parent(names.size());
+  function<int(int)> find = [&](int q) {
+    if (parent[q] == q) return q;
+    return parent[q] = find(parent[q]);
+  };
+
+  for (size_t q = 0; q < names.size(); q++) parent[q] = q;
+  vector<bool> busy(names.size(), false);
+  for (const auto& g : circ) {
+    for (int q : g) {
+      busy[q] = true;
+      parent[find(q)] = find(g.wires[0]);
+    }
+  }
+
+  // Regions are numbered in order of their first qubit
+  map<int, int> region;
+  vector<int> local(names.size());  // index of each qubit in its region
+  vector<dotqc> ret;
+  for (size_t q = 0; q < names.size(); q++) {
+    if (!busy[q]) continue;
+    const string & name = names[q];
+    const int root = find(q);
+    if (!region.count(root)) {
+      region[root] = ret.size();
+      ret.emplace_back();
+      ret.back().clear();
+    }
+    dotqc & sub = ret[region[root]];
+    local[q] = sub.names.size();
+    sub.names.push_back(name);
+    sub.zero[name] = zero.at(name);
+    if (zero.at(name)) sub.m++;
+    else sub.n++;
+  }
+  for (dotqc & sub : ret) {
+    for (const auto& name : input_wires) {
+      if (sub.zero.count(name)) sub.input_wires.push_back(name);
+    }
+    for (const auto& name : output_wires) {
+      if (sub.zero.count(name)) sub.output_wires.push_back(name);
+    }
+  }
+  for (const auto& g : circ) {
+    gate sub_gate = g;
+    for (int & q : sub_gate) q = local[q];
+    ret[region[find(g.wires[0])]].circ.push_back(sub_gate);
+  }
+  return ret;
+}
+
+static bool is_phase_gate(gate_type type) {
+  return type == gate_type::T || type == gate_type::T_DAG || type == gate_type::P
+    || type == gate_type::P_DAG || type == gate_type::Z;
+}
+
+// Each region is cut into stages, a run of other gates followed by a run of
+//   phase gates. The regions touch disjoint qubits so any interleaving is
+//   valid; emitting every region's k-th stage together, with all of the
+//   phase gates last, puts the k-th T layers of all regions in one layer
+dotqc dotqc::merge_regions(const vector<dotqc> & regions) const {
+  dotqc ret;
+  ret.n = n;
+  ret.m = m;
+  ret.names = names;
+  ret.zero = zero;
+  ret.input_wires = input_wires;
+  ret.output_wires = output_wires;
+
+  map<string, int> global;
+  for (size_t q = 0; q < names.size(); q++) global[names[q]] = q;
+
+  vector<vector<pair<gatelist, gatelist>>> stages(regions.size());
+  size_t num_stages = 0;
+  for (size_t i = 0; i < regions.size(); i++) {
+    vector<int> wire;
+    for (const auto& name : regions[i].names) wire.push_back(global.at(name));
+    for (gate g : regions[i].circ) {
+      for (int & q : g) q = wire[q];
+      if (stages[i].empty() || (!is_phase_gate(g.type) && !stages[i].back().second.empty())) {
+        stages[i].emplace_back();
+      }
+      if (is_phase_gate(g.type)) stages[i].back().second.push_back(g);
+      else stages[i].back().first.push_back(g);
+    }
+    num_stages = max(num_stages, stages[i].size());
+  }
+
+  for (size_t k = 0; k < num_stages; k++) {
+    for (auto & region : stages) {
+      if (k < region.size()) ret.circ.insert(ret.circ.end(), region[k].first.begin(), region[k].first.end());
+    }
+    for (auto & region : stages) {
+      if (k < region.size()) ret.circ.insert(ret.circ.end(), region[k].second.begin(), region[k].second.end());
+    }
+  }
+  return ret;
+}
+
 ostream& operator<<(ostream& out, const dotqc& circuit) {
     circuit.output(out);
     return out;
@@ -3,35 +3,110 @@
 
 #include <string>
 #include <list>
+#include <vector>
 #include <iostream>
 #include <map>
+#include <set>
+#include <functional>
+#include <deque>
+#include <unordered_map>
 
 #include "types.h"
 
 // Recognized gates are T, T*, P, P*, Z, Z*, Z a b c, tof a b, tof a, X, H
 
-// Internal representation of a .qc circuit circuit
+// The .qc spelling of a gate type
+const char * gate_name(gate_type type);
+// The gate type spelled name, or false if there's none
+bool parse_gate_type(const std::string & name, gate_type & type);
+
+// Internal representation of a .qc circuit circuit. Gates refer to qubits by
+//   their index in names, which are only spelled out again by output
 struct dotqc {
   int n;                   // number of unknown inputs
   int m;                   // number of known inputs (initialized to |0>)
-  std::list<std::string> names;      // names of qubits
+  std::vector<std::string> names;    // names of qubits
   std::map<std::string, bool> zero;  // mapping from qubits to 0 (non-zero) or 1 (zero)
   std::vector<std::string> input_wires, output_wires; // the .i and .o lines
   gatelist circ;           // Circuit
 
   void input(std::istream& in);
+  // The two halves of input: everything up to BEGIN, then one gate per call
+  //   until END, so a circuit can be read without keeping its gates. Qubits
+  //   are looked up in index, from name_index
+  void input_header(std::istream& in);
+  bool input_gate(std::istream& in, const std::unordered_map<std::string, int> & index,
+      gate & g) const;
+  // The position of each of names
+  std::unordered_map<std::string, int> name_index() const;
   void output(std::ostream& out) const;
+  // The pieces of output: everything up to BEGIN, then one gate per call.
+  //   END is left to the caller
+  void output_header(std::ostream& out) const;
+  void output_gate(std::ostream& out, const gate & g) const;
   void print() const {output(std::cout);}
   void clear() {n = 0; m = 0; names.clear(); zero.clear(); circ.clear();}
-  void append(std::pair<std::string, std::list<std::string> > gate);
   void remove_swaps();
   int count_t_depth() const;
   int count_h() const;
   void print_stats() const;
   void remove_ids();
   bool operator==(const dotqc& other) const;
+  // Splits the circuit into the sets of qubits no gate connects to each
+  //   other, one circuit each. Qubits with no gates on them are left out
+  std::vector<dotqc> split_independent() const;
+  // The inverse: a circuit on this one's qubits running all of the
+  //   regions, interleaved so their T layers line up. Region qubits are
+  //   matched to this circuit's by name
+  dotqc merge_regions(const std::vector<dotqc> & regions) const;
 };
 std::ostream& operator<<(std::ostream& out, const dotqc& circuit);
 
+// The statistics print_stats gives, gathered one gate at a time
+struct gate_stats {
+  int H = 0, cnot = 0, X = 0, T = 0, P = 0, Z = 0;
+  int tdepth = 0;            // by partitions
+  int critical_depth = 0;    // by critical paths
+  bool tlayer = false;
+  std::set<int> qubits;
+  std::vector<int> path_depth;   // by qubit index, grown as needed
+
+  void add(const gate & g);
+  void print(size_t num_qubits) const;
+};
+
+// Cancels gates with their inverses, like dotqc::remove_ids, in a stream of
+//   gates. Only the last size gates are kept to look back over; older ones
+//   are passed on to emit
+class identity_filter {
+  size_t size;
+  std::function<void(const gate &)> emit;
+  std::deque<gate> window;
+public:
+  identity_filter(size_t size, std::function<void(const gate &)> emit);
+  void push(const gate & g);
+  // Emits the gates left in the window
+  void flush();
+};
+
+// Takes swaps out of a stream of gates, like dotqc::remove_swaps, relabelling
+//   the qubits of the gates after them instead. Only three gates are held
+//   back to look for one; the swaps putting the qubits named names back in
+//   place come at the end, from flush
+class swap_filter {
+  std::vector<std::string> names;
+  std::function<void(const gate &)> emit;
+  std::deque<gate> pending;
+  std::vector<int> perm;
+  std::vector<bool> moved;
+
+  // Emits the first pending gate, or takes out the swap starting there
+  void pop();
+public:
+  swap_filter(const std::vector<std::string> & names, std::function<void(const gate &)> emit);
+  void push(const gate & g);
+  // Emits the gates held back, then the swaps fixing the outputs
+  void flush();
+};
 
 #endif
@@ -24,11 +24,11 @@ TEST(dotqc, superSimpleInput) {
 
     EXPECT_EQ(input_dotqc.n, 1);
     EXPECT_EQ(input_dotqc.m, 0);
-    list<string> names{"1"};
+    vector<string> names{"1"};
     EXPECT_EQ(input_dotqc.names, names);
     map<string, bool> zero{{"1", false}};
     EXPECT_EQ(input_dotqc.zero, zero);
-    gatelist circ{{"Z", {"1"} } };
+    gatelist circ{gate(gate_type::Z, {0}) };
     EXPECT_EQ(input_dotqc.circ, circ);
 
     dotqc initalized_dotqc {.n = 1, .m = 0,
@@ -36,7 +36,7 @@ TEST(dotqc, superSimpleInput) {
         .zero = {{"1", false}},
         .input_wires = {"1"},
         .output_wires = {"1"},
-        .circ = {{"Z", {"1"} }},
+        .circ = {gate(gate_type::Z, {0})},
     };
     EXPECT_EQ(input_dotqc, initalized_dotqc);
 }
@@ -62,7 +62,7 @@ TEST(dotqc, somewhatSimpleInput) {
         .zero = {{"1", false}, {"2", false}, {"3", false}, {"4", false}},
         .input_wires = {"1", "2", "3", "4"},
         .output_wires = {"1", "2", "3", "4"},
-        .circ = {{"Z", {"1"}}, {"Z", {"2", "3"}}},
+        .circ = {gate(gate_type::Z, {0}), gate(gate_type::Z, {1, 2})},
     };
     EXPECT_EQ(input_dotqc, initalized_dotqc);
 }
@@ -74,8 +74,8 @@ TEST(removeIds, zz) {
         .input_wires = {},
         .output_wires = {},
         .circ = {
-            {"Z", {"1"} },
-            {"Z", {"1"} },
+            gate(gate_type::Z, {0}),
+            gate(gate_type::Z, {0}),
         }
     };
     zz.remove_ids();
@@ -90,8 +90,8 @@ TEST(removeIds, czcz) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"Z", {"A", "B"} },
-            {"Z", {"A", "B"} },
+            gate(gate_type::Z, {0, 1}),
+            gate(gate_type::Z, {0, 1}),
         },
     };
     czcz.remove_ids();
@@ -105,17 +105,17 @@ TEST(removeIds, zazbza) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"Z", {"A"} },
-            {"Z", {"B"} },
-            {"Z", {"A"} },
+            gate(gate_type::Z, {0}),
+            gate(gate_type::Z, {1}),
+            gate(gate_type::Z, {0}),
         },
     };
     zazbza.remove_ids();
     EXPECT_EQ(1, zazbza.circ.size());
-    auto gate = *zazbza.circ.begin();
-    EXPECT_EQ("Z", gate.first);
-    EXPECT_EQ(1, gate.second.size());
-    EXPECT_EQ("B", *(gate.second.begin()));
+    auto g = *zazbza.circ.begin();
+    EXPECT_EQ(gate_type::Z, g.type);
+    EXPECT_EQ(1, g.size);
+    EXPECT_EQ("B", zazbza.names[g.wires[0]]);
 }
 
 TEST(removeIds, ztz) {
@@ -125,9 +125,9 @@ TEST(removeIds, ztz) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"Z", {"A"} },
-            {"T", {"A"} },
-            {"Z", {"A"} },
+            gate(gate_type::Z, {0}),
+            gate(gate_type::T, {0}),
+            gate(gate_type::Z, {0}),
         },
     };
     dotqc ztz_copy = ztz;
@@ -143,9 +143,9 @@ TEST(removeIds, ztz2) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"Z", {"A"} },
-            {"T", {"A", "B"} },
-            {"Z", {"A"} },
+            gate(gate_type::Z, {0}),
+            gate(gate_type::T, {0, 1}),
+            gate(gate_type::Z, {0}),
         },
     };
     dotqc ztz2_copy = ztz2;
@@ -161,8 +161,8 @@ TEST(removeIDs, tt) {
         .input_wires = {"1"},
         .output_wires = {"1"},
         .circ = {
-            {"T", {"1"} },
-            {"T", {"1"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::T, {0}),
         },
     };
     tt.remove_ids();
@@ -176,8 +176,8 @@ TEST(removeIDs, tts) {
         .input_wires = {"1"},
         .output_wires = {"1"},
         .circ = {
-            {"T", {"1"} },
-            {"T*", {"1"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::T_DAG, {0}),
         },
     };
     tt.remove_ids();
@@ -191,8 +191,8 @@ TEST(removeIDs, superset) {
         .input_wires = {"A", "B", "C"},
         .output_wires = {"A", "B", "C"},
         .circ = {
-            {"Z", {"A", "B"} },
-            {"Z", {"A", "B", "C"} },
+            gate(gate_type::Z, {0, 1}),
+            gate(gate_type::Z, {0, 1, 2}),
         },
     };
     dotqc zz_copy = zz;
@@ -211,8 +211,8 @@ TEST(removeIDs, yny) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"Y", {"A", "B"} },
-            {"Y", {"B", "A"} },
+            gate(gate_type::Y, {0, 1}),
+            gate(gate_type::Y, {1, 0}),
         },
     };
     yny.remove_ids();
@@ -226,23 +226,22 @@ TEST(removeIDs, yabc) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"Y", {"A", "B", "C"} },
-            {"Y", {"A", "C", "B"} },
+            gate(gate_type::Y, {0, 1, 2}),
+            gate(gate_type::Y, {0, 2, 1}),
         },
     };
     yny.remove_ids();
     EXPECT_EQ(2, yny.circ.size());
 }
 
-int max_depth(const map<string, int> & depths, const list<string> & names);
+int max_depth(const vector<int> & depths, const gate & g);
 TEST(depth, maxDepth) {
-    map<string, int> depths { {"Apple", 4}, {"Pear", 5}, {"Pinecone", 3} };
-    EXPECT_EQ(5, max_depth(depths, {"Apple", "Pear"}));
-    EXPECT_EQ(4, max_depth(depths, {"Apple"}));
-    EXPECT_EQ(0, max_depth(depths, {}));
+    vector<int> depths {4, 5, 3};
+    EXPECT_EQ(5, max_depth(depths, gate(gate_type::TOF, {0, 1})));
+    EXPECT_EQ(4, max_depth(depths, gate(gate_type::T, {0})));
+    EXPECT_EQ(0, max_depth(depths, gate(gate_type::T, {})));
     // Throws an error, that might be a good thing.
-    // Could mitigate by checking with map::count()
-    /* EXPECT_EQ(0, max_depth(depths, {"BEAR"})); */
+    EXPECT_THROW(max_depth(depths, gate(gate_type::T, {3})), out_of_range);
 }
 
 TEST(depth, countT) {
@@ -252,8 +251,8 @@ TEST(depth, countT) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"T", {"A"} },
-            {"Y", {"A", "C", "B"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::Y, {0, 2, 1}),
         },
     };
     EXPECT_EQ(1, t.count_t_depth());
@@ -266,8 +265,8 @@ TEST(depth, countNone) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"Z", {"A"} },
-            {"Y", {"A", "C", "B"} },
+            gate(gate_type::Z, {0}),
+            gate(gate_type::Y, {0, 2, 1}),
         },
     };
     EXPECT_EQ(0, no_t.count_t_depth());
@@ -280,8 +279,8 @@ TEST(depth, countTT) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"T", {"A"} },
-            {"T", {"A"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::T, {0}),
         },
     };
     EXPECT_EQ(2, tt.count_t_depth());
@@ -294,9 +293,9 @@ TEST(depth, transitive) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"T", {"A"} },
-            {"Y", {"A", "C", "B"} },
-            {"T", {"C"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::Y, {0, 2, 1}),
+            gate(gate_type::T, {2}),
         },
     };
     EXPECT_EQ(2, cir.count_t_depth());
@@ -309,10 +308,10 @@ TEST(depth, transitive2) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"T", {"A"} },
-            {"T", {"C"} },
-            {"Y", {"A", "C", "B"} },
-            {"T", {"C"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::T, {2}),
+            gate(gate_type::Y, {0, 2, 1}),
+            gate(gate_type::T, {2}),
         },
     };
     EXPECT_EQ(2, cir.count_t_depth());
@@ -325,31 +324,190 @@ TEST(depth, countH) {
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"T", {"A"} },
-            {"H", {"C"} },
-            {"Y", {"A", "C", "B"} },
-            {"H", {"C"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::H, {2}),
+            gate(gate_type::Y, {0, 2, 1}),
+            gate(gate_type::H, {2}),
         },
     };
     EXPECT_EQ(2, cir.count_h());
 }
 
-TEST(dotqc, append) {
+TEST(dotqc, pushGate) {
     dotqc cir {.n = 3, .m = 0,
         .names = {"A", "B", "C"},
         .zero = {{"A", false}, {"B", false}, {"C", false}},
         .input_wires = {"A", "B"},
         .output_wires = {"A", "B"},
         .circ = {
-            {"T", {"A"} },
-            {"H", {"C"} },
-            {"Y", {"A", "C", "B"} },
-            {"H", {"C"} },
+            gate(gate_type::T, {0}),
+            gate(gate_type::H, {2}),
+            gate(gate_type::Y, {0, 2, 1}),
+            gate(gate_type::H, {2}),
         },
     };
-    cir.append({{"T"}, {"A", "B"}});
+    cir.circ.push_back(gate(gate_type::T, {0, 1}));
     EXPECT_EQ(5, cir.circ.size());
     EXPECT_EQ(3, cir.names.size());
     EXPECT_EQ(2, cir.count_t_depth());
 }
 
+
+TEST(regions, splitAndMerge) {
+    dotqc cir {.n = 3, .m = 1,
+        .names = {"A", "B", "C", "D"},
+        .zero = {{"A", false}, {"B", false}, {"C", false}, {"D", true}},
+        .input_wires = {"A", "B", "C"},
+        .output_wires = {"A", "B", "C", "D"},
+        .circ = {
+            gate(gate_type::T, {0}),
+            gate(gate_type::TOF, {2, 0}),
+            gate(gate_type::H, {1}),
+            gate(gate_type::T, {1}),
+            gate(gate_type::T, {0}),
+        },
+    };
+    vector<dotqc> regions = cir.split_independent();
+    ASSERT_EQ(2, regions.size());
+    EXPECT_EQ((vector<string>{"A", "C"}), regions[0].names);
+    EXPECT_EQ(2, regions[0].n);
+    EXPECT_EQ(0, regions[0].m);
+    EXPECT_EQ(3, regions[0].circ.size());
+    EXPECT_EQ((vector<string>{"B"}), regions[1].names);
+    EXPECT_EQ(gate(gate_type::TOF, {1, 0}), regions[0].circ[1]);
+    EXPECT_EQ((vector<string>{"B"}), regions[1].output_wires);
+    EXPECT_EQ(2, regions[1].circ.size());
+
+    // The T layers of the two regions line up
+    dotqc merged = cir.merge_regions(regions);
+    EXPECT_EQ(cir.names, merged.names);
+    EXPECT_EQ(5, merged.circ.size());
+    EXPECT_EQ(1, count(merged.circ.begin(), merged.circ.end(), gate(gate_type::H, {1})));
+    EXPECT_EQ(2, merged.count_t_depth());
+    EXPECT_EQ(2, cir.count_t_depth());
+}
+
+TEST(regions, connected) {
+    dotqc cir {.n = 2, .m = 0,
+        .names = {"A", "B"},
+        .zero = {{"A", false}, {"B", false}},
+        .input_wires = {"A", "B"},
+        .output_wires = {"A", "B"},
+        .circ = {
+            gate(gate_type::TOF, {0, 1}),
+            gate(gate_type::T, {1}),
+        },
+    };
+    EXPECT_EQ(1, cir.split_independent().size());
+}
+
+TEST(dotqc, streamedInput) {
+    stringstream input;
+    input << ".v a b\n.i a b\n.o a b\n\nBEGIN\ntof a b\nT b\nEND\n";
+
+    dotqc header;
+    header.input_header(input);
+    EXPECT_EQ(2, header.n);
+    EXPECT_EQ((vector<string>{"a", "b"}), header.names);
+
+    gate g;
+    const auto index = header.name_index();
+    ASSERT_TRUE(header.input_gate(input, index, g));
+    EXPECT_EQ(gate(gate_type::TOF, {0, 1}), g);
+    ASSERT_TRUE(header.input_gate(input, index, g));
+    EXPECT_EQ(gate(gate_type::T, {1}), g);
+    EXPECT_FALSE(header.input_gate(input, index, g));
+    EXPECT_TRUE(header.circ.empty());
+}
+
+TEST(dotqc, gateStats) {
+    dotqc cir {.n = 3, .m = 0,
+        .names = {"A", "B", "C"},
+        .zero = {{"A", false}, {"B", false}, {"C", false}},
+        .input_wires = {"A", "B"},
+        .output_wires = {"A", "B"},
+        .circ = {
+            gate(gate_type::T, {0}),
+            gate(gate_type::T, {2}),
+            gate(gate_type::Y, {0, 2, 1}),
+            gate(gate_type::T, {2}),
+            gate(gate_type::Z, {0, 1, 2}),
+        },
+    };
+    gate_stats stats;
+    for (const auto& g : cir.circ) stats.add(g);
+    EXPECT_EQ(cir.count_t_depth(), stats.critical_depth);
+    EXPECT_EQ(10, stats.T);
+}
+
+TEST(removeIds, streamed) {
+    gatelist out;
+    identity_filter ids(2, [&out](const gate & g) { out.push_back(g); });
+    ids.push(gate(gate_type::T, {0}));
+    ids.push(gate(gate_type::H, {1}));
+    ids.push(gate(gate_type::T_DAG, {0}));     // cancels with the first T, across the H
+    ids.push(gate(gate_type::TOF, {0, 1}));
+    ids.push(gate(gate_type::T, {2}));      // pushes H out of the window
+    ids.push(gate(gate_type::T, {2}));
+    ids.push(gate(gate_type::X, {3}));
+    ids.flush();
+    gatelist expected{gate(gate_type::H, {1}), gate(gate_type::TOF, {0, 1}),
+        gate(gate_type::T, {2}), gate(gate_type::T, {2}), gate(gate_type::X, {3})};
+    EXPECT_EQ(expected, out);
+}
+
+TEST(removeSwaps, relabels) {
+    dotqc cir {.n = 3, .m = 0,
+        .names = {"A", "B", "C"},
+        .zero = {{"A", false}, {"B", false}, {"C", false}},
+        .input_wires = {"A", "B", "C"},
+        .output_wires = {"A", "B", "C"},
+        .circ = {
+            gate(gate_type::TOF, {0, 1}),
+            gate(gate_type::TOF, {1, 0}),
+            gate(gate_type::TOF, {0, 1}),
+            gate(gate_type::T, {0}),
+            gate(gate_type::H, {2}),
+        },
+    };
+    cir.remove_swaps();
+    // The swap moves to the end, with the gates in between on its other side
+    gatelist expected{gate(gate_type::T, {1}), gate(gate_type::H, {2}),
+        gate(gate_type::TOF, {1, 0}), gate(gate_type::TOF, {0, 1}), gate(gate_type::TOF, {1, 0})};
+    EXPECT_EQ(expected, cir.circ);
+}
+
+TEST(removeSwaps, streamed) {
+    // The swap relabels the T, so it cancels with the T* that follows, once
+    //   both of them are out of the swap filter
+    dotqc cir {.n = 3, .m = 0,
+        .names = {"A", "B", "C"},
+        .zero = {{"A", false}, {"B", false}, {"C", false}},
+        .input_wires = {"A", "B", "C"},
+        .output_wires = {"A", "B", "C"},
+        .circ = {
+            gate(gate_type::T, {1}),
+            gate(gate_type::TOF, {0, 1}),
+            gate(gate_type::TOF, {1, 0}),
+            gate(gate_type::TOF, {0, 1}),
+            gate(gate_type::T_DAG, {0}),
+            gate(gate_type::H, {2}),
+            gate(gate_type::TOF, {2, 0}),
+            gate(gate_type::TOF, {0, 2}),
+            gate(gate_type::TOF, {2, 0}),
+        },
+    };
+
+    gatelist out;
+    identity_filter ids(cir.circ.size(), [&out](const gate & g) { out.push_back(g); });
+    swap_filter swaps(cir.names, [&ids](const gate & g) { ids.push(g); });
+    for (const auto& g : cir.circ) swaps.push(g);
+    swaps.flush();
+    ids.flush();
+
+    // The last swap isn't followed by anything, so it stays
+    cir.remove_swaps();
+    cir.remove_ids();
+    EXPECT_EQ(cir.circ, out);
+    EXPECT_EQ(7u, out.size());
+}
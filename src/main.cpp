@@ -20,8 +20,15 @@ Author: Matthew Amy
 ---------------------------------------------------------------------*/
 
 #include "circuit.h"
+#include "stats.h"
+#include "cnot_cache.h"
+#include "worker_pool.h"
 #include <cstdio>
 #include <iomanip>
+#include <fstream>
+#include <thread>
+#include <mutex>
+#include <memory>
 
 #include <boost/program_options.hpp>
 namespace po = boost::program_options;
@@ -47,12 +54,154 @@ clock_gettime(int foo, struct timespec *ts)
 
 using namespace std;
 
+// Reads an --ancillae argument: a number, n (-1) or unbounded (-2)
+static bool parse_ancillae(const string & ancillae, int & anc) {
+  if(ancillae == "n") {
+      anc = -1;
+  } else if (ancillae == "unbounded") {
+      anc = -2;
+  } else {
+      try {
+      anc = boost::lexical_cast<int>(ancillae);
+      if (anc < 0) {
+          cout << "Error: less than 0 ancillae" << endl;
+          return false;
+      }
+      } catch (const boost::bad_lexical_cast &)
+      {
+          cout << "Error: Malformed argument to --ancillae" << endl;
+          cout << ancillae << endl;
+          return false;
+      }
+  }
+  return true;
+}
+
+static double seconds(const struct timespec & start, const struct timespec & end) {
+  return (end.tv_sec + (double)end.tv_nsec/1000000000)
+      - (start.tv_sec + (double)start.tv_nsec/1000000000);
+}
+
+// Adds the ancillae --ancillae asked for to c, but for unbounded, which
+//   synthesize_unbounded adds as it goes
+static void add_ancillae(character & c, int anc) {
+  if (anc == -1) c.add_ancillae(c.n + c.m);
+  else if (anc > 0) c.add_ancillae(anc);
+}
+
+// Adds the requested ancillae to c and resynthesizes it, timing the synthesis
+static dotqc resynthesize(character & c, int anc, struct timespec & start,
+    struct timespec & end) {
+  dotqc synth;
+
+  if (disp_log) cerr << "anc is " << anc << endl;
+  add_ancillae(c, anc);
+  if (disp_log) cerr << "Resynthesizing circuit...\n" << flush;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (anc == -2) synth = c.synthesize_unbounded();
+  else           synth = c.synthesize();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  return synth;
+}
+
+// resynthesize, but with each gate written to cout as it's made, unless
+//   stats_only, and counted into stats. With post_process, swaps are taken
+//   out and identities cancelled over the last window gates instead of by
+//   the post-processing, so only those are kept, except with unbounded
+//   ancillae, whose qubits aren't known until the end. Returns the circuit
+//   without its gates
+static dotqc stream_resynthesis(character & c, int anc, bool post_process,
+    size_t window, bool stats_only, gate_stats & stats,
+    struct timespec & start, struct timespec & end) {
+  dotqc synth;
+  identity_filter ids(post_process ? window : 0, [&](const gate & g) {
+    stats.add(g);
+    if (!stats_only) synth.output_gate(cout, g);
+  });
+  unique_ptr<swap_filter> swaps;
+  auto push = [&](const gate & g) {
+    if (swaps) swaps->push(g);
+    else       ids.push(g);
+  };
+
+  if (disp_log) cerr << "anc is " << anc << endl;
+  add_ancillae(c, anc);
+  if (disp_log) cerr << "Resynthesizing circuit...\n" << flush;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  if (anc == -2) {
+    synth = c.synthesize_unbounded();
+    if (!stats_only) synth.output_header(cout);
+    if (post_process) swaps.reset(new swap_filter(synth.names, [&ids](const gate & g) { ids.push(g); }));
+    for (const auto& g : synth.circ) push(g);
+    synth.circ.clear();
+  } else {
+    synth = c.empty_circuit();
+    if (!stats_only) synth.output_header(cout);
+    if (post_process) swaps.reset(new swap_filter(synth.names, [&ids](const gate & g) { ids.push(g); }));
+    c.synthesize(push);
+  }
+  if (swaps) swaps->flush();
+  ids.flush();
+  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (!stats_only) cout << "END\n";
+  return synth;
+}
+
+// Synthesizes c once for each ancilla budget, on the shared workers, and
+//   reports how each one did. Every budget starts from its own copy of the
+//   character, so the circuit is only parsed once. Without ancillae the
+//   regions of circuit are synthesized instead when there are several, as
+//   they would be without the sweep
+static void sweep_ancillae(const character & c, const vector<string> & budgets,
+    const dotqc & circuit, const vector<dotqc> & regions, bool post_process,
+    const string & prefix) {
+  vector<dotqc> synths(budgets.size());
+  vector<double> times(budgets.size());
+
+  shared_workers().run(budgets.size(), [&](size_t i) {
+    struct timespec start, end;
+    int anc = 0;
+    parse_ancillae(budgets[i], anc);
+    if (anc == 0 && regions.size() > 1) {
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      synths[i] = synthesize_regions(circuit, regions);
+      clock_gettime(CLOCK_MONOTONIC, &end);
+    } else {
+      character copy = c;
+      add_ancillae(copy, anc);
+      clock_gettime(CLOCK_MONOTONIC, &start);
+      synths[i] = anc == -2 ? copy.synthesize_unbounded() : copy.synthesize();
+      clock_gettime(CLOCK_MONOTONIC, &end);
+    }
+    if (post_process) {
+      synths[i].remove_swaps();
+      synths[i].remove_ids();
+    }
+    times[i] = seconds(start, end);
+  });
+
+  cout << "# Ancilla sweep\n";
+  cout << fixed << setprecision(3);
+  for (size_t i = 0; i < budgets.size(); i++) {
+    gate_stats stats;
+    for (const auto& gate : synths[i].circ) stats.add(gate);
+    cout << "#   ancillae " << budgets[i] << ": qubits " << synths[i].names.size()
+      << ", T " << stats.T << ", tdepth " << stats.critical_depth
+      << ", cnot " << stats.cnot << ", time " << times[i] << " s\n";
+    if (!prefix.empty()) {
+      ofstream out(prefix + budgets[i] + ".qc");
+      synths[i].output(out);
+    }
+  }
+}
 
 int main(int argc, char *argv[]) {
   struct timespec start, end;
   dotqc circuit, synth;
   bool post_process = true;
   int anc = 0;
+  int num_threads = max(1u, thread::hardware_concurrency());
+  int stream_window = 64;
 
 
   po::options_description desc("Allowed Options");
@@ -62,6 +211,29 @@ int main(int argc, char *argv[]) {
       ("no-post-process", po::value<bool>(&post_process)->implicit_value(false)->default_value(true),
        "Remove identities in a post processing step")
       ("synth", po::value<string>())
+      ("order", po::value<string>(),
+       "Order of terms added to the partition (natural, weight, highest, overlap or random (default))")
+      ("seed", po::value<unsigned int>(&term_order_seed)->default_value(0),
+       "Seed for --order random")
+      ("time-budget", po::value<double>(&partition_time_budget),
+       "Seconds to spend on exact partitioning before placing the remaining terms greedily")
+      ("threads", po::value<int>(&num_threads),
+       "Number of threads to synthesize with")
+      ("ancillae-sweep", po::value<string>(),
+       "Comma separated ancilla budgets (as for --ancillae) to synthesize the circuit with, in parallel")
+      ("sweep-output", po::value<string>(),
+       "Write the circuit for each budget of --ancillae-sweep to this prefix followed by the budget and .qc")
+      ("stream", "Parse gates straight into the phase polynomial, and write the optimized circuit as it's made, without keeping either circuit")
+      ("stream-window", po::value<int>(&stream_window),
+       "Gates --stream looks back over to cancel identities (default 64)")
+      ("stats-only", "Print the statistics of the optimized circuit, but not the circuit")
+      ("pmh-config", po::value<string>(),
+       "Read the PMH section size for each matrix size from this file, as written by --tune-pmh")
+      ("tune-pmh", po::value<string>(),
+       "Try PMH section sizes 1 to 8 on the CNOT matrices of this circuit and write the best for each matrix size to this file")
+      ("cnot-cache", po::value<size_t>(),
+       "CNOT circuits to remember and reuse when the same transformation comes up again (default 4096, 0 to disable)")
+      ("stats-json", po::value<string>(), "Write the partitioner counters to this file as JSON")
       ("verbose,v", "Display additional logging")
       ;
 
@@ -85,26 +257,8 @@ int main(int argc, char *argv[]) {
   disp_log = vm.count("verbose");
   cout << "# Logging: " << (disp_log ? "Yes" : "No") << endl;
 
-  if (vm.count("ancillae")) { // TODO unbounded and n
-      string ancillae = vm["ancillae"].as<string>();
-      if(ancillae == "n") {
-          anc = -1;
-      } else if (ancillae == "unbounded") {
-          anc = -2;
-      } else {
-          try {
-          anc = boost::lexical_cast<int>(ancillae);
-          if (anc < 0) {
-              cout << "Error: less than 0 ancillae" << endl;
-              return 1;
-          }
-          } catch (const boost::bad_lexical_cast &)
-          {
-              cout << "Error: Malformed argument to --ancillae" << endl;
-              cout << ancillae << endl;
-              return 1;
-          }
-      }
+  if (vm.count("ancillae")) {
+      if (!parse_ancillae(vm["ancillae"].as<string>(), anc)) return 1;
       if(disp_log) {
           cout << "ancillae: " << anc << endl;
       }
@@ -113,6 +267,25 @@ int main(int argc, char *argv[]) {
           cout << "ancillae: No" << endl;
       }
   }
+  vector<string> sweep;
+  if (vm.count("ancillae-sweep")) {
+      if (vm.count("ancillae")) {
+          cout << "Error: --ancillae and --ancillae-sweep can't be used together" << endl;
+          return 1;
+      }
+      stringstream budgets(vm["ancillae-sweep"].as<string>());
+      string budget;
+      while (getline(budgets, budget, ',')) {
+          if (!parse_ancillae(budget, anc)) return 1;
+          sweep.push_back(budget);
+      }
+      anc = 0;
+  }
+  const bool sweeping = !sweep.empty();
+  if (vm.count("cnot-cache")) {
+      cnot_memo().set_capacity(vm["cnot-cache"].as<size_t>());
+  }
+  const string sweep_prefix = vm.count("sweep-output") ? vm["sweep-output"].as<string>() : "";
   if (vm.count("synth")) {
       string syth_opt = vm["synth"].as<string>();
       if (syth_opt == "ADHOC") {
@@ -123,6 +296,8 @@ int main(int argc, char *argv[]) {
           synth_method = GAUSS;
       } else if (syth_opt == "PMH") {
           synth_method = PMH;
+      } else if (syth_opt == "PORTFOLIO" || syth_opt == "portfolio") {
+          synth_method = PORTFOLIO;
       } else {
           cout << "Error: Invalid argument to --synth" << endl; // TODO
       }
@@ -135,36 +310,144 @@ int main(int argc, char *argv[]) {
       }
   }
 
+  if (vm.count("order")) {
+      string order_opt = vm["order"].as<string>();
+      if (order_opt == "natural") {
+          term_order = ORDER_NATURAL;
+      } else if (order_opt == "weight") {
+          term_order = ORDER_WEIGHT;
+      } else if (order_opt == "highest") {
+          term_order = ORDER_HIGHEST_VAR;
+      } else if (order_opt == "overlap") {
+          term_order = ORDER_OVERLAP;
+      } else if (order_opt == "random") {
+          term_order = ORDER_RANDOM;
+      } else {
+          cout << "Error: Invalid argument to --order" << endl;
+          return 1;
+      }
+      if(disp_log) {
+          cout << "term order: " << order_opt << endl;
+      }
+  }
+
+  if (num_threads < 1) {
+      cout << "Error: --threads must be at least 1" << endl;
+      return 1;
+  }
+  // The main thread partitions while the workers build T layers
+  shared_workers().resize(num_threads);
+  layer_workers = num_threads - 1;
+
+  if (vm.count("pmh-config")) {
+      ifstream config(vm["pmh-config"].as<string>());
+      if (!config || !read_pmh_sections(config, pmh_sections)) {
+          cout << "Error: Can't read --pmh-config " << vm["pmh-config"].as<string>() << endl;
+          return 1;
+      }
+  }
+  // The matrices are kept as they're synthesized, and the section sizes
+  //   tried on them once the circuit is done
+  mutex tune_lock;
+  vector<vector<xor_func>> tune_mats;
+  if (vm.count("tune-pmh")) {
+      pmh_observer = [&tune_lock, &tune_mats](const vector<xor_func> & mat) {
+          lock_guard<mutex> guard(tune_lock);
+          tune_mats.push_back(mat);
+      };
+  }
+  auto finish_tuning = [&vm, &tune_mats]() {
+      if (!vm.count("tune-pmh")) return;
+      pmh_observer = nullptr;
+      ofstream config(vm["tune-pmh"].as<string>());
+      write_pmh_sections(config, tune_pmh(tune_mats, 8, cout));
+  };
+
+  // Without a circuit to print the statistics of first, they come after it
+  const bool stats_only = vm.count("stats-only");
+  const bool stream_out = vm.count("stream");
+  gate_stats streamed;
+  auto synthesize = [&](character & c) {
+      if (!stream_out) synth = resynthesize(c, anc, start, end);
+      else synth = stream_resynthesis(c, anc, post_process, max(stream_window, 0),
+              stats_only, streamed, start, end);
+  };
+
   if (disp_log) cerr << "Reading circuit...\n" << flush;
-  circuit.input(cin);
-  cout << "# Original circuit\n" << flush;
-  circuit.print_stats();
-  cout << flush;
-
-  circuit.remove_ids();
-  if (disp_log) cerr << "With full character" << endl;
-  if (disp_log) cerr << "Parsing circuit...\n" << flush;
-  character c{circuit};
-  if (disp_log) cerr << "anc is " << anc << endl;
-  if (anc == -1) c.add_ancillae(c.n + c.m);
-  else if (anc > 0) c.add_ancillae(anc);
-  if (disp_log) cerr << "Resynthesizing circuit...\n" << flush;
-  clock_gettime(CLOCK_MONOTONIC, &start);
-  if (anc == -2) synth = c.synthesize_unbounded();
-  else           synth = c.synthesize();
-  clock_gettime(CLOCK_MONOTONIC, &end);
+  if (vm.count("stream")) {
+      // Each gate goes into the character as it's read, once it leaves the
+      //   window identities are cancelled in, so the circuit is never stored
+      gate_stats original;
+      gate g;
+
+      circuit.input_header(cin);
+      const auto index = circuit.name_index();
+      character_builder builder(circuit);
+      identity_filter ids(max(stream_window, 0),
+          [&builder](const gate & g) { builder.add_gate(g); });
+      while (circuit.input_gate(cin, index, g)) {
+          original.add(g);
+          ids.push(g);
+      }
+      ids.flush();
+      cout << "# Original circuit\n" << flush;
+      original.print(circuit.names.size());
+      cout << flush;
+
+      character c{move(builder)};
+      if (sweeping) sweep_ancillae(c, sweep, circuit, {}, post_process, sweep_prefix);
+      else          synthesize(c);
+  } else {
+      circuit.input(cin);
+      cout << "# Original circuit\n" << flush;
+      circuit.print_stats();
+      cout << flush;
 
-  if (post_process) {
+      circuit.remove_ids();
+      // Qubits no gate connects can be synthesized separately. Ancillae are
+      //   shared by the whole circuit, so only without them
+      vector<dotqc> regions;
+      if (anc == 0) regions = circuit.split_independent();
+      if (sweeping) {
+          if (disp_log) cerr << "Parsing circuit...\n" << flush;
+          character c{circuit};
+          sweep_ancillae(c, sweep, circuit, regions, post_process, sweep_prefix);
+      } else if (regions.size() > 1) {
+          if (disp_log) cerr << "Resynthesizing " << regions.size() << " independent regions...\n" << flush;
+          clock_gettime(CLOCK_MONOTONIC, &start);
+          synth = synthesize_regions(circuit, regions);
+          clock_gettime(CLOCK_MONOTONIC, &end);
+      } else {
+          if (disp_log) cerr << "With full character" << endl;
+          if (disp_log) cerr << "Parsing circuit...\n" << flush;
+          character c{circuit};
+          synthesize(c);
+      }
+  }
+
+  if (post_process && !stream_out && !sweeping) {
       if (disp_log) cerr << "Applying post-processing...\n" << flush;
       synth.remove_swaps();
       synth.remove_ids();
   }
-  cout << "# Optimized circuit\n";
-  synth.print_stats();
-  cout << fixed << setprecision(3);
-  cout << "#   Time: " << (end.tv_sec + (double)end.tv_nsec/1000000000)
-      - (start.tv_sec + (double)start.tv_nsec/1000000000) << " s\n";
-  synth.print();
+  finish_tuning();
+  if (sweeping) {
+      // The sweep reported each circuit, so only the counters of all of them
+      collect_stats().print(cout);
+  } else {
+      cout << "# Optimized circuit\n";
+      if (stream_out) streamed.print(synth.names.size());
+      else            synth.print_stats();
+      collect_stats().print(cout);
+      cout << fixed << setprecision(3);
+      cout << "#   Time: " << seconds(start, end) << " s\n";
+      if (!stream_out && !stats_only) synth.print();
+  }
+
+  if (vm.count("stats-json")) {
+      ofstream json(vm["stats-json"].as<string>());
+      collect_stats().print_json(json);
+  }
 
   return 0;
 }
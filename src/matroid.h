@@ -24,6 +24,8 @@ Author: Matthew Amy
 
 #include <vector>
 #include <deque>
+#include <map>
+#include <unordered_map>
 #include <assert.h>
 #include <boost/optional.hpp>
 
@@ -31,24 +33,80 @@ Author: Matthew Amy
 #include "partition.h"
 
 struct path {
-  std::list<std::pair <xor_func, partitioning::iterator> > lst;
+  std::list<std::pair <term_id, partitioning::iterator> > lst;
 
   path() { }
-  path(xor_func i, partitioning::iterator ref) { lst.push_front(make_pair(i, ref)); }
+  path(term_id i, partitioning::iterator ref) { lst.push_front(make_pair(i, ref)); }
   path(const path & p) { lst = p.lst; }
-  path(xor_func i, partitioning::iterator ref, path & p) {
+  path(term_id i, partitioning::iterator ref, path & p) {
     lst = p.lst;
     lst.push_front(make_pair(i, ref));
   }
 
-  std::pair<xor_func, partitioning::iterator> head() { return lst.front(); }
-  xor_func                               head_elem() { return lst.front().first; }
+  std::pair<term_id, partitioning::iterator> head() { return lst.front(); }
+  term_id                                head_elem() { return lst.front().first; }
   partitioning::iterator                 head_part() { return lst.front().second; }
 
   path_iterator begin() { return lst.begin(); }
   path_iterator   end() { return lst.end(); }
 
-  void insert(xor_func i, partitioning::iterator ref) { lst.push_front(make_pair(i, ref)); }
+  void insert(term_id i, partitioning::iterator ref) { lst.push_front(make_pair(i, ref)); }
+};
+
+// Exchange graph edges found by earlier insertions. For a part S and a
+//   candidate x, records whether S + x is independent and, for the elements
+//   y of S probed so far, whether S + x - y is. Parts are known by their
+//   address, which a partitioning keeps for as long as the part is in it, so
+//   entries stay valid until S or the oracle changes. The owner of the
+//   partition must invalidate parts it edits or removes before another set
+//   can take their place, and clear the cache when the oracle changes. At
+//   most capacity candidates are kept; past that, everything is dropped.
+class exchange_cache {
+  public:
+    struct entry {
+      int fits = -1;                    // -1 until probed
+      std::map<term_id, bool> swaps;
+    };
+  private:
+    struct part_entries {
+      size_t size;                      // of the part, to catch a missed invalidate
+      std::unordered_map<term_id, entry> candidates;
+    };
+    std::unordered_map<const term_set *, part_entries> parts;
+    size_t capacity;
+    size_t count = 0;
+  public:
+    explicit exchange_cache(size_t capacity = 1 << 16) : capacity(capacity) {}
+
+    // The entry stays valid until the next call on the cache
+    entry & lookup(const term_set & part, term_id x) {
+      auto it = parts.find(&part);
+      if (it != parts.end()) {
+        assert(it->second.size == part.size());
+        auto found = it->second.candidates.find(x);
+        if (found != it->second.candidates.end()) return found->second;
+      }
+      if (count >= capacity) {
+        clear();
+        it = parts.end();
+      }
+      if (it == parts.end()) {
+        it = parts.emplace(&part, part_entries{part.size(), {}}).first;
+      }
+      count++;
+      return it->second.candidates[x];
+    }
+    void invalidate(const term_set & part) {
+      auto it = parts.find(&part);
+      if (it == parts.end()) return;
+      count -= it->second.candidates.size();
+      parts.erase(it);
+    }
+    void invalidate(const partitioning & part) {
+      for (const auto & st : part) invalidate(st);
+    }
+    void clear() { parts.clear(); count = 0; }
+    size_t size() const { return count; }
 };
 
 
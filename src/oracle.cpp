@@ -1,11 +1,13 @@
 #include "oracle.h"
 #include "util.h"
+#include "stats.h"
 #include <boost/optional.hpp>
 
 using namespace std;
 
 
 bool ind_oracle::operator()(const set<xor_func> & lst) const {
+  local_stats().oracle_calls++;
   if (lst.size() > this->num) return false;
   if (lst.size() == 1 || (this->num - lst.size()) >= this->dim) return true;
 
@@ -23,10 +25,23 @@ bool ind_oracle::operator()(const set<xor_func> & lst) const {
   return (this->num - lst.size()) >= (this->dim - rank);
 }
 
+bool ind_oracle::operator()(const term_set & lst) const {
+  assert(terms != nullptr);
+  local_stats().oracle_calls++;
+  const int size = lst.size();
+  if (size > this->num) return false;
+  if (size == 1 || (this->num - size) >= this->dim) return true;
+
+  // A set of rank above dim never fits
+  const int missing = this->dim - terms->rank(lst);
+  return missing >= 0 && (this->num - size) >= missing;
+}
+
 //TODO audit this
 // Shortcut to find a linearly dependent element faster
 boost::optional<xor_func>
 ind_oracle::retrieve_lin_dep(const set<xor_func> & lst) const {
+  local_stats().lin_dep_searches++;
   set<xor_func>::const_iterator it;
   map<int, xor_func> mp;
   bool flg;
@@ -76,3 +91,16 @@ ind_oracle::retrieve_lin_dep(const set<xor_func> & lst) const {
   return boost::optional<xor_func>();
 }
 
+
+boost::optional<term_id>
+ind_oracle::retrieve_lin_dep(const term_set & lst) const {
+  assert(terms != nullptr);
+  set<xor_func> funcs;
+  for (const term_id id : lst) {
+    funcs.insert((*terms)[id]);
+  }
+
+  boost::optional<xor_func> dep = retrieve_lin_dep(funcs);
+  if (!dep) return boost::none;
+  return terms->find(*dep);
+}
@@ -1,22 +1,33 @@
 #ifndef ORACLE_H
 #define ORACLE_H
 #include <set>
+#include <cassert>
 #include <boost/optional.hpp>
 
 #include "xor_func.h"
+#include "term_table.h"
 
 class ind_oracle {
   private:
     int num;
     int dim;
     int length;
+    const term_table * terms;   // what the ids in a term_set refer to
   public:
-    ind_oracle() { num = 0; dim = 0; length = 0; }
-    ind_oracle(int numin, int dimin, int lengthin) { num = numin; dim = dimin; length = lengthin; }
+    ind_oracle() { num = 0; dim = 0; length = 0; terms = nullptr; }
+    ind_oracle(int numin, int dimin, int lengthin) {
+      num = numin; dim = dimin; length = lengthin; terms = nullptr;
+    }
+    ind_oracle(int numin, int dimin, int lengthin, const term_table * termsin) {
+      num = numin; dim = dimin; length = lengthin; terms = termsin;
+    }
 
     void set_dim(int newdim) { dim = newdim; }
+    const term_table & table() const { assert(terms != nullptr); return *terms; }
     boost::optional<xor_func> retrieve_lin_dep(const std::set<xor_func> & lst) const;
+    boost::optional<term_id> retrieve_lin_dep(const term_set & lst) const;
 
     bool operator()(const std::set<xor_func> & lst) const;
+    bool operator()(const term_set & lst) const;
 };
 #endif // ORACLE_H
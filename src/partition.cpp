@@ -20,10 +20,57 @@ Author: Matthew Amy
 ---------------------------------------------------------------------*/
 
 #include "partition.h"
+#include "stats.h"
 #include <list>
+#include <random>
+#include <chrono>
+#include <atomic>
+#include <algorithm>
+#include <unordered_set>
 
 using namespace std;
 
+order_type term_order = ORDER_RANDOM;
+unsigned int term_order_seed = 0;
+
+// Seconds after partitioning starts that add_to_partition may go on
+//   inserting exactly, < 0 for no limit. Once they're up, the remaining terms
+//   are placed greedily
+double partition_time_budget = -1;
+
+// One deadline for the whole process, so every thread partitioning, whatever
+//   region or budget it works on, shares the same time. Set by the first
+//   thread to need it, so reading the circuit doesn't count
+static const chrono::steady_clock::rep clock_unstarted =
+  chrono::steady_clock::time_point::min().time_since_epoch().count();
+static atomic<chrono::steady_clock::rep> partition_deadline{clock_unstarted};
+
+static chrono::steady_clock::rep deadline_from_now() {
+  using clock = chrono::steady_clock;
+  const clock::time_point now = clock::now();
+  clock::time_point deadline = clock::time_point::max();
+  if (partition_time_budget >= 0 &&
+      partition_time_budget < chrono::duration<double>(deadline - now).count()) {
+    deadline = now + chrono::duration_cast<clock::duration>(
+        chrono::duration<double>(partition_time_budget));
+  }
+  return deadline.time_since_epoch().count();
+}
+
+void start_partition_clock() {
+  partition_deadline = deadline_from_now();
+}
+
+static bool budget_spent() {
+  auto deadline = partition_deadline.load();
+  if (deadline == clock_unstarted) {
+    // Whoever gets there first sets it, and the others see theirs
+    const auto started = deadline_from_now();
+    if (partition_deadline.compare_exchange_strong(deadline, started)) deadline = started;
+  }
+  return chrono::steady_clock::now().time_since_epoch().count() >= deadline;
+}
+
 template<typename T>
 bool is_disjoint(const set<T> & A, const set<T> & B) {
   return 0 == set_intersection_count(A.begin(), A.end(), B.begin(), B.end());
@@ -42,9 +89,9 @@ ostream& operator<<(ostream& output, const partitioning& part) {
   return output;
 }
 
-// Take a partition and a set of xor_funcs, and return all partitions that are not
+// Take a partition and a set of terms, and return all partitions that are not
 //   disjoint with the set, also removing them from the partition
-partitioning freeze_partitions(partitioning & part, set<xor_func> & st) {
+partitioning freeze_partitions(partitioning & part, term_set & st) {
   partitioning ret;
   partitioning::iterator it, tmp;
 
@@ -69,16 +116,48 @@ int num_elts(partitioning & part) {
   return tot;
 }
 
-partitioning create(const set<xor_func> & st) {
+partitioning create(const term_set & st) {
   return partitioning{st};
 }
 
 //-------------------------------------- Matroids
 
 // Implements a matroid partitioning algorithm
-void add_to_partition(partitioning & ret, xor_func i, const ind_oracle & oracle) {
+void add_to_partition(partitioning & ret, term_id i, const ind_oracle & oracle) {
+  exchange_cache cache;
+  add_to_partition(ret, i, oracle, cache);
+}
+
+// First fit insertion, used once the time budget is spent
+static void greedy_add_to_partition(partitioning & ret, term_id i,
+    const ind_oracle & oracle, exchange_cache & cache) {
+  partition_stats & stats = local_stats();
+
+  stats.greedy_insertions++;
+  for (auto Si = ret.begin(); Si != ret.end(); Si++) {
+    exchange_cache::entry & known = cache.lookup(*Si, i);
+    Si->insert(i);
+    if (known.fits == -1) {
+      known.fits = oracle(*Si);
+    } else {
+      stats.exchange_cache_hits++;
+    }
+    if (known.fits) {
+      cache.invalidate(*Si);
+      return;
+    }
+    Si->erase(i);
+  }
+
+  ret.push_front(term_set{i});
+  stats.parts_created++;
+}
+
+void add_to_partition(partitioning & ret, term_id i, const ind_oracle & oracle,
+    exchange_cache & cache) {
+  partition_stats & stats = local_stats();
   partitioning::iterator Si;
-  set<xor_func>::iterator yi, zi;
+  term_set::iterator yi, zi;
 
   // The node q contains a queue of paths and an iterator to each node's location.
   //    Each path's first element is the element we grow more paths from.
@@ -87,7 +166,8 @@ void add_to_partition(partitioning & ret, xor_func i, const ind_oracle & oracle)
   path t;
   path_iterator p;
   bool flag;
-  map<xor_func, bool> marked;
+  // Only the ids the search reaches, so an insertion doesn't cost the whole table
+  unordered_set<term_id> marked;
 
   // Reset everything
   node_q.clear();
@@ -98,24 +178,42 @@ void add_to_partition(partitioning & ret, xor_func i, const ind_oracle & oracle)
 
   // Insert element to be partitioned
   node_q.push_back(path(i, ret.end()));
-  marked[i] = true;
+  marked.insert(i);
 
   // BFS loop
   while (!node_q.empty() && !flag) {
+    // Out of time. The partition is unmodified between iterations, so give up
+    if (budget_spent()) {
+      greedy_add_to_partition(ret, i, oracle, cache);
+      return;
+    }
+
     // The head of the path is what we're currently considering
     t = node_q.front();
     node_q.pop_front();
+    stats.bfs_nodes++;
 
     for (Si = ret.begin(); Si != ret.end() && !flag; Si++) {
       if (Si != t.head_part()) {
+        exchange_cache::entry & known = cache.lookup(*Si, t.head_elem());
+
         // Add the head to Si. If Si is independent, leave it, otherwise we'll have to remove it
         Si->insert(t.head_elem());
 
-        if (oracle(*Si)) {
+        if (known.fits == -1) {
+          known.fits = oracle(*Si);
+        } else {
+          stats.exchange_cache_hits++;
+        }
+
+        if (known.fits) {
           // We have the shortest path to a partition, so make the changes:
           //	For each x->y in the path, remove x from its partition and add y
+          stats.add_path(t.lst.size());
+          cache.invalidate(*Si);
           for (p = t.begin(); p != --(t.end()); ) {
             Si = p->second;
+            cache.invalidate(*Si);
             (Si)->erase(p->first);
             (Si)->insert((++p)->first);
           }
@@ -123,21 +221,28 @@ void add_to_partition(partitioning & ret, xor_func i, const ind_oracle & oracle)
         } else {
           // For each element of Si, if removing it makes an independent set, add it to the queue
           for (yi = Si->begin(); yi != Si->end(); yi++) {
-            if (!marked[*yi]) {
-              // Generate an iterator to the position before yi
-              zi = yi;
-              if (zi != Si->begin()) zi--;
-              // Take yi out
-              auto tmp = *yi;
-              Si->erase(yi);
-              if (oracle(*Si)) {
+            if (marked.count(*yi) == 0) {
+              auto swap_it = known.swaps.find(*yi);
+              bool swappable;
+              if (swap_it != known.swaps.end()) {
+                swappable = swap_it->second;
+                stats.exchange_cache_hits++;
+              } else {
+                // Generate an iterator to the position before yi
+                zi = yi;
+                if (zi != Si->begin()) zi--;
+                // Take yi out
+                auto tmp = *yi;
+                Si->erase(yi);
+                swappable = oracle(*Si);
                 // Put yi back in
                 yi = Si->insert(Si->begin(), tmp);
+                known.swaps[tmp] = swappable;
+              }
+              if (swappable) {
                 // Add yi to the queue
                 node_q.push_back(path(*yi, Si, t));
-                marked[*yi] = true;
-              } else {
-                yi = Si->insert(Si->begin(), tmp);
+                marked.insert(*yi);
               }
             }
           }
@@ -150,15 +255,63 @@ void add_to_partition(partitioning & ret, xor_func i, const ind_oracle & oracle)
 
   // We were unsuccessful trying to edit the current partitions
   if (!flag) {
-    set<xor_func> newset;
-    newset.insert(i);
-    ret.push_front(newset);
+    ret.push_front(term_set{i});
+    stats.parts_created++;
   }
 
+  stats.exact_insertions++;
+}
+
+// Per thread, so synthesizing one circuit doesn't move another's order along
+static thread_local mt19937 term_order_rng(term_order_seed);
+
+void restart_term_order() {
+  term_order_rng.seed(term_order_seed);
+}
+
+// Reorder a batch of terms before they're added to the partition
+//   overlap(id) should give the number of pending hadamards that need the term
+void order_terms(vector<term_id> & ids, const term_table & terms, order_type order,
+        function<int(term_id)> overlap) {
+
+  switch (order) {
+    case ORDER_NATURAL:
+      break;
+    case ORDER_WEIGHT:
+      stable_sort(ids.begin(), ids.end(),
+          [&terms](term_id a, term_id b) {
+            return terms.weight(a) < terms.weight(b);
+          });
+      break;
+    case ORDER_HIGHEST_VAR:
+      stable_sort(ids.begin(), ids.end(),
+          [&terms](term_id a, term_id b) {
+            return terms.highest_var(a) < terms.highest_var(b);
+          });
+      break;
+    case ORDER_OVERLAP: {
+      vector<pair<int, term_id>> keyed;
+      keyed.reserve(ids.size());
+      for (const term_id id : ids) {
+        keyed.emplace_back(overlap(id), id);
+      }
+      stable_sort(keyed.begin(), keyed.end(),
+          [](const pair<int, term_id> & a, const pair<int, term_id> & b) {
+            return a.first > b.first;
+          });
+      for (size_t i = 0; i < keyed.size(); i++) {
+        ids[i] = keyed[i].second;
+      }
+      break;
+    }
+    case ORDER_RANDOM:
+      shuffle(ids.begin(), ids.end(), term_order_rng);
+      break;
+  }
 }
 
 // Partition the matroid
-partitioning partition_matroid(const vector<xor_func> & elts, const ind_oracle & oracle) {
+partitioning partition_matroid(const vector<term_id> & elts, const ind_oracle & oracle) {
   partitioning ret;
 
   // For each element of the matroid
@@ -169,17 +322,25 @@ partitioning partition_matroid(const vector<xor_func> & elts, const ind_oracle &
 }
 
 void repartition(partitioning & partition, const ind_oracle & oracle ) {
-    list<xor_func> acc;
+    exchange_cache cache;
+    repartition(partition, oracle, cache);
+}
 
-    for (set<xor_func>& part : partition) {
-        boost::optional<xor_func> dep = oracle.retrieve_lin_dep(part);
+// The oracle has changed, so anything in the cache is stale
+void repartition(partitioning & partition, const ind_oracle & oracle,
+        exchange_cache & cache) {
+    list<term_id> acc;
+
+    cache.clear();
+    for (term_set& part : partition) {
+        boost::optional<term_id> dep = oracle.retrieve_lin_dep(part);
         if(dep) {
             part.erase(*dep);
             acc.push_back(*dep);
+            local_stats().repartition_evictions++;
         }
     }
     for(const auto& dep : acc) {
-        add_to_partition(partition, dep, oracle);
+        add_to_partition(partition, dep, oracle, cache);
     }
 }
-
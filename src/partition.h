@@ -24,17 +24,37 @@ Author: Matthew Amy
 
 #include <list>
 #include <set>
+#include <vector>
 #include <iostream>
+#include <functional>
 
 #include "util.h"
 #include "matroid.h"
 
+class exchange_cache;
+
+extern order_type term_order;
+extern unsigned int term_order_seed;
+extern double partition_time_budget;
+// Starts partition_time_budget running out now, rather than when the first
+//   term is partitioned
+void start_partition_clock();
+
 std::ostream& operator<<(std::ostream& output, const partitioning& part);
-partitioning freeze_partitions(partitioning & part, std::set<xor_func> & st);
+partitioning freeze_partitions(partitioning & part, term_set & st);
 
 int num_elts(partitioning & part);
-partitioning create(const std::set<xor_func> & st);
-void add_to_partition(partitioning & ret, xor_func i, const ind_oracle & oracle);
+partitioning create(const term_set & st);
+void add_to_partition(partitioning & ret, term_id i, const ind_oracle & oracle);
+void add_to_partition(partitioning & ret, term_id i, const ind_oracle & oracle,
+    exchange_cache & cache);
 void repartition(partitioning & partition, const ind_oracle & oracle );
-partitioning partition_matroid(const std::vector<xor_func> & elts, const ind_oracle & oracle);
+void repartition(partitioning & partition, const ind_oracle & oracle,
+    exchange_cache & cache);
+// Starts this thread's random term order over from term_order_seed, so a
+//   synthesis doesn't depend on what the thread synthesized before
+void restart_term_order();
+void order_terms(std::vector<term_id> & ids, const term_table & terms, order_type order,
+        std::function<int(term_id)> overlap);
+partitioning partition_matroid(const std::vector<term_id> & elts, const ind_oracle & oracle);
 #endif
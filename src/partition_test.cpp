@@ -6,46 +6,52 @@
 #include "types.h"
 #include "matroid.h"
 #include "oracle.h"
+#include "stats.h"
 
 #include <boost/dynamic_bitset.hpp>
 
 using namespace std;
 
 TEST(partitions, creation) {
-    xor_func a{false, {0,0,1,0}};
-    xor_func b{false, {0,0,0,1}};
+    term_table terms(4);
+    term_id a = terms.intern({false, {0,0,1,0}});
+    term_id b = terms.intern({false, {0,0,0,1}});
 
-    partitioning p = create(set<xor_func>{a,b});
+    partitioning p = create(term_set{a,b});
     ASSERT_EQ(1, p.size());
 }
 
 TEST(partitions, n2d2) {
-    xor_func a{false, {0,0,1,0}};
-    xor_func b{false, {0,0,0,1}};
+    term_table terms(4);
+    term_id a = terms.intern({false, {0,0,1,0}});
+    term_id b = terms.intern({false, {0,0,0,1}});
 
-    ind_oracle oracle(2,2,4);
-    partitioning p = create(set<xor_func>{a,b});
+    ind_oracle oracle(2,2,4,&terms);
+    partitioning p = create(term_set{a,b});
 
-    add_to_partition(p, {false, {0,0,1,1}}, oracle);
+    add_to_partition(p, terms.intern({false, {0,0,1,1}}), oracle);
     EXPECT_EQ(2, p.size());
-    add_to_partition(p, {false, {0,1,0,1}}, oracle);
+    add_to_partition(p, terms.intern({false, {0,1,0,1}}), oracle);
     EXPECT_EQ(2, p.size());
-    add_to_partition(p, {false, {0,1,1,0}}, oracle);
+    add_to_partition(p, terms.intern({false, {0,1,1,0}}), oracle);
     EXPECT_EQ(3, p.size());
-    add_to_partition(p, {false, {0,1,1,1}}, oracle);
+    add_to_partition(p, terms.intern({false, {0,1,1,1}}), oracle);
     EXPECT_EQ(3, p.size());
     /* cout << p << endl; */
 }
 
 TEST(partitions, repartition) {
-    xor_func a{false, {0,0,1,0}};
-    xor_func b{false, {0,0,0,1}};
+    term_table terms(4);
+    term_id a = terms.intern({false, {0,0,1,0}});
+    term_id b = terms.intern({false, {0,0,0,1}});
+    term_id c = terms.intern({false, {0,1,0,0}});
+    term_id d = terms.intern({false, {0,1,1,0}});
 
-    ind_oracle oracle(3,2,4);
-    partitioning p = create(set<xor_func>{a,b});
+    ind_oracle oracle(3,2,4,&terms);
+    partitioning p = create(term_set{a,b});
 
-    add_to_partition(p, {false, {0,1,0,0}}, oracle);
-    add_to_partition(p, {false, {0,1,1,0}}, oracle);
+    add_to_partition(p, c, oracle);
+    add_to_partition(p, d, oracle);
     EXPECT_EQ(2, p.size());
     /* cout << p << endl; */
     oracle.set_dim(2);
@@ -53,3 +59,97 @@ TEST(partitions, repartition) {
     EXPECT_EQ(2, p.size());
     /* cout << p << endl; */
 }
+
+TEST(partitions, orderTerms) {
+    term_table terms(4);
+    term_id a = terms.intern({false, {1,1,1,0}});
+    term_id b = terms.intern({false, {0,0,1,0}});
+    term_id c = terms.intern({false, {1,0,0,0}});
+    auto no_overlap = [](term_id) { return 0; };
+
+    vector<term_id> ids{a, b, c};
+    order_terms(ids, terms, ORDER_NATURAL, no_overlap);
+    EXPECT_EQ((vector<term_id>{a, b, c}), ids);
+
+    order_terms(ids, terms, ORDER_WEIGHT, no_overlap);
+    EXPECT_EQ((vector<term_id>{b, c, a}), ids);
+
+    ids = {a, b, c};
+    order_terms(ids, terms, ORDER_HIGHEST_VAR, no_overlap);
+    EXPECT_EQ((vector<term_id>{c, a, b}), ids);
+
+    ids = {a, b, c};
+    order_terms(ids, terms, ORDER_OVERLAP, [c](term_id id) {
+        return id == c ? 2 : 0;
+    });
+    EXPECT_EQ((vector<term_id>{c, a, b}), ids);
+
+    order_terms(ids, terms, ORDER_RANDOM, no_overlap);
+    EXPECT_EQ(3, ids.size());
+}
+
+TEST(partitions, exchangeCache) {
+    term_table terms(4);
+    term_id a = terms.intern({false, {0,0,1,0}});
+    term_id b = terms.intern({false, {0,0,0,1}});
+    vector<term_id> elts{
+        terms.intern({false, {0,0,1,1}}), terms.intern({false, {0,1,0,1}}),
+        terms.intern({false, {0,1,1,0}}), terms.intern({false, {0,1,1,1}})};
+
+    ind_oracle oracle(2,2,4,&terms);
+    exchange_cache cache;
+    partitioning p = create(term_set{a,b});
+    partitioning q = create(term_set{a,b});
+
+    for (const term_id f : elts) {
+        add_to_partition(p, f, oracle);
+        add_to_partition(q, f, oracle, cache);
+        EXPECT_EQ(p, q);
+    }
+}
+
+TEST(partitions, exchangeCacheBounded) {
+    term_set s{1, 2}, t{3};
+    exchange_cache cache(2);
+
+    cache.lookup(s, 4).fits = 1;
+    cache.lookup(s, 5).fits = 0;
+    EXPECT_EQ(1, cache.lookup(s, 4).fits);
+    EXPECT_EQ(2u, cache.size());
+
+    // Full, so a new candidate drops what's there
+    EXPECT_EQ(-1, cache.lookup(t, 4).fits);
+    EXPECT_EQ(1u, cache.size());
+    EXPECT_EQ(-1, cache.lookup(s, 4).fits);
+
+    cache.invalidate(s);
+    EXPECT_EQ(1u, cache.size());
+}
+
+TEST(partitions, timeBudget) {
+    term_table terms(4);
+    term_id a = terms.intern({false, {0,0,1,0}});
+    term_id b = terms.intern({false, {0,0,0,1}});
+    vector<term_id> elts{
+        terms.intern({false, {0,0,1,1}}), terms.intern({false, {0,1,0,1}}),
+        terms.intern({false, {0,1,1,0}}), terms.intern({false, {0,1,1,1}})};
+
+    ind_oracle oracle(2,2,4,&terms);
+    partitioning p = create(term_set{a,b});
+
+    // With no time at all every term is placed first fit
+    const unsigned long greedy = local_stats().greedy_insertions;
+    partition_time_budget = 0;
+    start_partition_clock();
+    for (const term_id f : elts) {
+        add_to_partition(p, f, oracle);
+    }
+    partition_time_budget = -1;
+    start_partition_clock();
+
+    EXPECT_EQ(greedy + elts.size(), local_stats().greedy_insertions);
+    EXPECT_EQ(6, num_elts(p));
+    for (const auto& part : p) {
+        EXPECT_TRUE(oracle(part));
+    }
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "rank_tracker.h"
+
+using namespace std;
+
+// The nonzero reduced vectors are kept fully reduced: each pivot column is
+//   set in its own vector and no other. The combos are kept linearly
+//   independent, so every row shows up in at least one of them.
+
+rank_tracker::rank_tracker(const vector<xor_func> & wires) :
+  rnk(0),
+  width(wires.empty() ? 0 : wires[0].size()),
+  combo_width(wires.size())
+{
+  rows.assign(wires.size(), boost::dynamic_bitset<>(width));
+  reduced.assign(wires.size(), boost::dynamic_bitset<>(width));
+  combo.assign(wires.size(), boost::dynamic_bitset<>(wires.size()));
+  pivot.assign(wires.size(), -1);
+  for (size_t i = 0; i < wires.size(); i++) {
+    combo[i].set(i);
+  }
+  for (size_t i = 0; i < wires.size(); i++) {
+    replace(i, wires[i]);
+  }
+}
+
+void rank_tracker::eliminate(size_t from, size_t into) {
+  reduced[into] ^= reduced[from];
+  combo[into] ^= combo[from];
+}
+
+void rank_tracker::replace(size_t q, const xor_func & row) {
+  if (q >= rows.size()) {
+    if (row.none()) return;
+    while (rows.size() <= q) store_row();
+  }
+  if (rows[q] == row.bits()) return;
+
+  // Pick one vector p whose combo uses row q and take q out of the others.
+  //   If a zero vector uses q, removing the row doesn't change the rank.
+  //   Otherwise every vector using q has a pivot that p doesn't, so adding
+  //   p to them keeps their pivots, and p's pivot is simply freed
+  size_t p = rows.size();
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (combo[i].test(q) && (p == rows.size() || pivot[i] == -1)) {
+      p = i;
+      if (pivot[i] == -1) break;
+    }
+  }
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (i != p && combo[i].test(q)) eliminate(p, i);
+  }
+  if (pivot[p] != -1) rnk--;
+
+  // p now stands for row q alone, so put the new row in its place
+  rows[q] = row.bits();
+  reduced[p] = row.bits();
+  combo[p].reset();
+  combo[p].set(q);
+  pivot[p] = -1;
+  for (size_t i = 0; i < rows.size(); i++) {
+    if (pivot[i] != -1 && reduced[p].test(pivot[i])) eliminate(i, p);
+  }
+
+  const size_t col = reduced[p].find_first();
+  if (col != boost::dynamic_bitset<>::npos) {
+    pivot[p] = col;
+    rnk++;
+    for (size_t i = 0; i < rows.size(); i++) {
+      if (i != p && reduced[i].test(col)) eliminate(p, i);
+    }
+  }
+}
+
+void rank_tracker::add_row() {
+  zeros++;
+}
+
+// Stores the first of the zero rows. The combos grow by doubling, so this
+//   is amortized O(1) besides the row itself
+void rank_tracker::store_row() {
+  const size_t i = rows.size();
+
+  if (i + 1 > combo_width) {
+    combo_width = max(2 * combo_width, i + 1);
+    for (auto & c : combo) c.resize(combo_width);
+  }
+  rows.emplace_back(width);
+  reduced.emplace_back(width);
+  combo.emplace_back(combo_width);
+  combo[i].set(i);
+  pivot.push_back(-1);
+  zeros--;
+}
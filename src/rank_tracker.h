@@ -0,0 +1,38 @@
+#ifndef RANK_TRACKER_H
+#define RANK_TRACKER_H
+
+#include <vector>
+#include <boost/dynamic_bitset.hpp>
+
+#include "xor_func.h"
+
+// Rank of a matrix of wires under row replacement, ignoring negations.
+//   Keeps a reduced echelon form of the rows along with, for each reduced
+//   vector, which rows it's the sum of, so a row can be swapped out in
+//   O(rows * words) rather than eliminating the whole matrix again.
+//   Zero rows added at the end (ancillae) aren't stored until they're first
+//   replaced with something else.
+class rank_tracker {
+  private:
+    std::vector<boost::dynamic_bitset<> > rows;
+    std::vector<boost::dynamic_bitset<> > reduced;
+    std::vector<boost::dynamic_bitset<> > combo;   // reduced[i] is the sum of rows in combo[i]
+    std::vector<int> pivot;                         // pivot column of reduced[i], -1 if it's zero
+    int rnk;
+    size_t width;                 // bits per row
+    size_t combo_width;           // bits per combo, at least rows.size()
+    size_t zeros = 0;             // zero rows after the stored ones
+
+    void eliminate(size_t from, size_t into);
+    void store_row();
+  public:
+    explicit rank_tracker(const std::vector<xor_func> & wires);
+
+    int rank() const { return rnk; }
+    size_t size() const { return rows.size() + zeros; }
+
+    void replace(size_t i, const xor_func & row);
+    // Appends a zero row
+    void add_row();
+};
+#endif // RANK_TRACKER_H
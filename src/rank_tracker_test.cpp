@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "rank_tracker.h"
+#include "util.h"
+
+using namespace std;
+
+TEST(rankTracker, initial) {
+    vector<xor_func> wires{
+        {false, {1,1,0,0}}, {true, {0,1,1,0}}, {false, {1,0,1,0}}};
+    rank_tracker tracker(wires);
+    EXPECT_EQ(2, tracker.rank());
+
+    tracker.replace(2, {false, {0,0,0,1}});
+    EXPECT_EQ(3, tracker.rank());
+    tracker.replace(0, {false, {0,0,0,0}});
+    EXPECT_EQ(2, tracker.rank());
+
+    tracker.add_row();
+    EXPECT_EQ(4, tracker.size());
+    EXPECT_EQ(2, tracker.rank());
+    tracker.replace(3, {false, {1,0,0,0}});
+    EXPECT_EQ(3, tracker.rank());
+}
+
+TEST(rankTracker, matchesElimination) {
+    mt19937 rng(7);
+    const int rows = 6, width = 8;
+    vector<xor_func> wires(rows, xor_func(width));
+    rank_tracker tracker(wires);
+
+    for (int step = 0; step < 500; step++) {
+        const int i = rng() % rows;
+        xor_func row(width);
+        // Sparse rows so that dependencies come up often
+        for (int b = 0; b < width; b++) {
+            if (rng() % 4 == 0) row.set(b);
+        }
+        wires[i] = row;
+        tracker.replace(i, row);
+        ASSERT_EQ(compute_rank(wires), tracker.rank());
+    }
+}
+
+TEST(rankTracker, zeroRows) {
+    mt19937 rng(11);
+    const int width = 8;
+    vector<xor_func> wires(3, xor_func(width));
+    rank_tracker tracker(wires);
+
+    for (int step = 0; step < 300; step++) {
+        if (step % 20 == 0) {
+            wires.push_back(xor_func(width));
+            tracker.add_row();
+        }
+        ASSERT_EQ(wires.size(), tracker.size());
+        const int i = rng() % wires.size();
+        xor_func row(width);
+        for (int b = 0; b < width; b++) {
+            if (rng() % 4 == 0) row.set(b);
+        }
+        wires[i] = row;
+        tracker.replace(i, row);
+        ASSERT_EQ(compute_rank(wires), tracker.rank());
+    }
+}
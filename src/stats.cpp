@@ -0,0 +1,159 @@
+#include <mutex>
+#include <set>
+
+#include "stats.h"
+
+using namespace std;
+
+static mutex registry_lock;
+
+static set<partition_stats *> & live_stats() {
+  static set<partition_stats *> live;
+  return live;
+}
+
+// Counters of threads that have already exited
+static partition_stats & retired_stats() {
+  static partition_stats retired;
+  return retired;
+}
+
+// Lists a thread's counters while it runs, and folds them into the
+//   retired total when it exits
+struct stats_registration {
+  partition_stats stats;
+
+  stats_registration() {
+    lock_guard<mutex> lock(registry_lock);
+    live_stats().insert(&stats);
+  }
+  ~stats_registration() {
+    lock_guard<mutex> lock(registry_lock);
+    retired_stats() += stats;
+    live_stats().erase(&stats);
+  }
+};
+
+partition_stats & local_stats() {
+  thread_local stats_registration reg;
+  return reg.stats;
+}
+
+partition_stats collect_stats() {
+  lock_guard<mutex> lock(registry_lock);
+  partition_stats ret = retired_stats();
+  for (const partition_stats * stats : live_stats()) {
+    ret += *stats;
+  }
+  return ret;
+}
+
+void partition_stats::add_path(size_t length) {
+  lock_guard<mutex> guard(lock);
+  if (path_lengths.size() <= length) path_lengths.resize(length + 1);
+  path_lengths[length]++;
+}
+
+void partition_stats::add_win(const string & method) {
+  lock_guard<mutex> guard(lock);
+  portfolio_wins[method]++;
+}
+
+partition_stats & partition_stats::operator=(const partition_stats & other) {
+  if (this == &other) return *this;
+  partition_stats copy(other);
+  oracle_calls = copy.oracle_calls;
+  rank_computations = copy.rank_computations;
+  lin_dep_searches = copy.lin_dep_searches;
+  bfs_nodes = copy.bfs_nodes;
+  exchange_cache_hits = copy.exchange_cache_hits;
+  parts_created = copy.parts_created;
+  repartition_evictions = copy.repartition_evictions;
+  exact_insertions = copy.exact_insertions;
+  greedy_insertions = copy.greedy_insertions;
+  cnot_cache_hits = copy.cnot_cache_hits;
+  cnot_cache_misses = copy.cnot_cache_misses;
+  lock_guard<mutex> guard(lock);
+  path_lengths = move(copy.path_lengths);
+  portfolio_wins = move(copy.portfolio_wins);
+  return *this;
+}
+
+partition_stats & partition_stats::operator+=(const partition_stats & other) {
+  oracle_calls += other.oracle_calls;
+  rank_computations += other.rank_computations;
+  lin_dep_searches += other.lin_dep_searches;
+  bfs_nodes += other.bfs_nodes;
+  exchange_cache_hits += other.exchange_cache_hits;
+  parts_created += other.parts_created;
+  repartition_evictions += other.repartition_evictions;
+  exact_insertions += other.exact_insertions;
+  greedy_insertions += other.greedy_insertions;
+  cnot_cache_hits += other.cnot_cache_hits;
+  cnot_cache_misses += other.cnot_cache_misses;
+  // Another thread may be counting into other
+  std::lock(lock, other.lock);
+  lock_guard<mutex> guard(lock, adopt_lock), other_guard(other.lock, adopt_lock);
+  if (path_lengths.size() < other.path_lengths.size()) {
+    path_lengths.resize(other.path_lengths.size());
+  }
+  for (size_t i = 0; i < other.path_lengths.size(); i++) {
+    path_lengths[i] += other.path_lengths[i];
+  }
+  for (const auto& wins : other.portfolio_wins) {
+    portfolio_wins[wins.first] += wins.second;
+  }
+  return *this;
+}
+
+void partition_stats::print(ostream & out) const {
+  out << "#   Oracle calls: " << oracle_calls << "\n";
+  out << "#   Rank computations: " << rank_computations << "\n";
+  out << "#   Linear dependency searches: " << lin_dep_searches << "\n";
+  out << "#   BFS nodes expanded: " << bfs_nodes << "\n";
+  out << "#   Exchange cache hits: " << exchange_cache_hits << "\n";
+  out << "#   Parts created: " << parts_created << "\n";
+  out << "#   Repartition evictions: " << repartition_evictions << "\n";
+  out << "#   Terms placed exactly: " << exact_insertions << "\n";
+  out << "#   Terms placed greedily: " << greedy_insertions << "\n";
+  out << "#   CNOT cache hits: " << cnot_cache_hits << "\n";
+  out << "#   CNOT cache misses: " << cnot_cache_misses << "\n";
+  out << "#   Augmenting path lengths:";
+  for (size_t i = 0; i < path_lengths.size(); i++) {
+    if (path_lengths[i] != 0) out << " " << i << ":" << path_lengths[i];
+  }
+  out << "\n";
+  if (!portfolio_wins.empty()) {
+    out << "#   Portfolio wins:";
+    for (const auto& wins : portfolio_wins) out << " " << wins.first << ":" << wins.second;
+    out << "\n";
+  }
+}
+
+void partition_stats::print_json(ostream & out) const {
+  out << "{\n";
+  out << "  \"oracle_calls\": " << oracle_calls << ",\n";
+  out << "  \"rank_computations\": " << rank_computations << ",\n";
+  out << "  \"lin_dep_searches\": " << lin_dep_searches << ",\n";
+  out << "  \"bfs_nodes\": " << bfs_nodes << ",\n";
+  out << "  \"exchange_cache_hits\": " << exchange_cache_hits << ",\n";
+  out << "  \"parts_created\": " << parts_created << ",\n";
+  out << "  \"repartition_evictions\": " << repartition_evictions << ",\n";
+  out << "  \"exact_insertions\": " << exact_insertions << ",\n";
+  out << "  \"greedy_insertions\": " << greedy_insertions << ",\n";
+  out << "  \"cnot_cache_hits\": " << cnot_cache_hits << ",\n";
+  out << "  \"cnot_cache_misses\": " << cnot_cache_misses << ",\n";
+  out << "  \"path_lengths\": [";
+  for (size_t i = 0; i < path_lengths.size(); i++) {
+    if (i != 0) out << ", ";
+    out << path_lengths[i];
+  }
+  out << "],\n";
+  out << "  \"portfolio_wins\": {";
+  for (auto it = portfolio_wins.begin(); it != portfolio_wins.end(); it++) {
+    if (it != portfolio_wins.begin()) out << ", ";
+    out << "\"" << it->first << "\": " << it->second;
+  }
+  out << "}\n";
+  out << "}\n";
+}
@@ -0,0 +1,71 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <vector>
+#include <iostream>
+#include <map>
+#include <string>
+#include <atomic>
+#include <mutex>
+
+// A count only its own thread bumps, which others may read while it does.
+//   Relaxed, as nothing is ordered by it
+class stat_counter {
+  std::atomic<unsigned long> value{0};
+public:
+  stat_counter() = default;
+  stat_counter(unsigned long n) : value(n) {}
+  stat_counter(const stat_counter & other) : value(other.get()) {}
+  stat_counter & operator=(const stat_counter & other) { return *this = other.get(); }
+  stat_counter & operator=(unsigned long n) {
+    value.store(n, std::memory_order_relaxed);
+    return *this;
+  }
+  // With a single writer, a load and a store are enough
+  stat_counter & operator+=(unsigned long n) { return *this = get() + n; }
+  void operator++(int) { *this += 1; }
+  unsigned long get() const { return value.load(std::memory_order_relaxed); }
+  operator unsigned long() const { return get(); }
+};
+
+// Counters for the matroid partitioner and the circuit construction after
+//   it. Each thread counts into its own
+//   copy (see local_stats), and collect_stats adds them all up, so they're
+//   cheap to bump from anywhere.
+struct partition_stats {
+  stat_counter oracle_calls;          // ind_oracle::operator()
+  stat_counter rank_computations;     // full eliminations, in or out of the oracle
+  stat_counter lin_dep_searches;      // ind_oracle::retrieve_lin_dep
+  stat_counter bfs_nodes;             // nodes expanded by add_to_partition
+  stat_counter exchange_cache_hits;   // oracle calls answered by an exchange_cache
+  stat_counter parts_created;
+  stat_counter repartition_evictions; // terms moved by repartition
+  stat_counter exact_insertions;
+  stat_counter greedy_insertions;
+  stat_counter cnot_cache_hits;       // CNOT circuits reused from the cnot_cache
+  stat_counter cnot_cache_misses;
+  // path_lengths[k] is the number of augmenting paths with k elements
+  std::vector<unsigned long> path_lengths;
+  // CNOT layers each method of --synth PORTFOLIO gave the shortest circuit for
+  std::map<std::string, unsigned long> portfolio_wins;
+  // Held while path_lengths or portfolio_wins change, or another thread
+  //   reads them
+  mutable std::mutex lock;
+
+  partition_stats() = default;
+  partition_stats(const partition_stats & other) { *this += other; }
+  partition_stats & operator=(const partition_stats & other);
+
+  void add_path(size_t length);
+  void add_win(const std::string & method);
+  partition_stats & operator+=(const partition_stats & other);
+  void print(std::ostream & out) const;
+  void print_json(std::ostream & out) const;
+};
+
+// The calling thread's counters
+partition_stats & local_stats();
+// Sum of every thread's counters, as far as the ones still running have
+//   got. Only exact once the other threads have finished counting.
+partition_stats collect_stats();
+#endif // STATS_H
@@ -0,0 +1,89 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <thread>
+#include <atomic>
+
+#include "stats.h"
+#include "partition.h"
+#include "oracle.h"
+
+using namespace std;
+
+TEST(stats, pathLengths) {
+    partition_stats stats;
+    stats.add_path(1);
+    stats.add_path(3);
+    stats.add_path(3);
+    ASSERT_EQ(4, stats.path_lengths.size());
+    EXPECT_EQ(0, stats.path_lengths[0]);
+    EXPECT_EQ(1, stats.path_lengths[1]);
+    EXPECT_EQ(0, stats.path_lengths[2]);
+    EXPECT_EQ(2, stats.path_lengths[3]);
+
+    partition_stats other;
+    other.add_path(5);
+    other.oracle_calls = 7;
+    stats += other;
+    EXPECT_EQ(6, stats.path_lengths.size());
+    EXPECT_EQ(1, stats.path_lengths[5]);
+    EXPECT_EQ(7, stats.oracle_calls);
+}
+
+TEST(stats, partitionerCounts) {
+    const partition_stats before = local_stats();
+    term_table terms(4);
+    ind_oracle oracle(2,2,4,&terms);
+    partitioning p;
+
+    add_to_partition(p, terms.intern({false, {0,0,1,0}}), oracle);
+    add_to_partition(p, terms.intern({false, {0,0,0,1}}), oracle);
+    add_to_partition(p, terms.intern({false, {0,0,1,1}}), oracle);
+
+    const partition_stats & after = local_stats();
+    EXPECT_EQ(before.exact_insertions + 3, after.exact_insertions);
+    EXPECT_EQ(before.parts_created + 2, after.parts_created);
+    EXPECT_LT(before.bfs_nodes, after.bfs_nodes);
+    EXPECT_LT(before.oracle_calls, after.oracle_calls);
+}
+
+TEST(stats, mergesThreads) {
+    const unsigned long before = collect_stats().oracle_calls;
+
+    thread worker([]() { local_stats().oracle_calls += 5; });
+    worker.join();
+    local_stats().oracle_calls += 2;
+
+    EXPECT_EQ(before + 7, collect_stats().oracle_calls);
+}
+
+TEST(stats, collectsWhileCounting) {
+    const unsigned long before = collect_stats().bfs_nodes;
+    atomic<bool> started{false};
+
+    thread worker([&started]() {
+        started = true;
+        for (int i = 0; i < 10000; i++) {
+            local_stats().bfs_nodes++;
+            local_stats().add_path(i % 4);
+        }
+    });
+    while (!started) { }
+    for (int i = 0; i < 100; i++) {
+        EXPECT_LE(before, collect_stats().bfs_nodes);
+    }
+    worker.join();
+
+    EXPECT_EQ(before + 10000, collect_stats().bfs_nodes);
+}
+
+TEST(stats, json) {
+    partition_stats stats;
+    stats.bfs_nodes = 12;
+    stats.add_path(2);
+
+    stringstream out;
+    stats.print_json(out);
+    EXPECT_NE(string::npos, out.str().find("\"bfs_nodes\": 12,"));
+    EXPECT_NE(string::npos, out.str().find("\"path_lengths\": [0, 0, 1]"));
+}
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <numeric>
+
+#include <boost/functional/hash.hpp>
+
+#include "term_table.h"
+#include "stats.h"
+
+using namespace std;
+
+term_table::term_table(size_t length) :
+  length(length),
+  stride((length + boost::dynamic_bitset<>::bits_per_block - 1)
+      / boost::dynamic_bitset<>::bits_per_block)
+{ }
+
+void term_table::resize(size_t new_length) {
+  const size_t new_stride = (new_length + boost::dynamic_bitset<>::bits_per_block - 1)
+      / boost::dynamic_bitset<>::bits_per_block;
+  vector<block> new_rows(size() * new_stride, 0);
+  for (term_id i = 0; i < size(); i++) {
+    copy(row(i), row(i) + min(stride, new_stride), new_rows.data() + i * new_stride);
+  }
+  rows.swap(new_rows);
+  length = new_length;
+  stride = new_stride;
+
+  index.clear();
+  for (term_id i = 0; i < size(); i++) {
+    index.emplace(hash_row(row(i), negated[i]), i);
+  }
+}
+
+void term_table::pack(const xor_func & f, vector<block> & out) const {
+  out.assign(stride, 0);
+  f.to_blocks(out.begin());
+}
+
+size_t term_table::hash_row(const block * row, bool neg) const {
+  size_t seed = neg;
+  boost::hash_range(seed, row, row + stride);
+  return seed;
+}
+
+bool term_table::equal_row(term_id id, const block * row, bool neg) const {
+  return negated[id] == neg && equal(row, row + stride, this->row(id));
+}
+
+constexpr term_id term_table::dropped;
+
+term_id term_table::intern(const xor_func & f) {
+  vector<block> packed;
+  pack(f, packed);
+  return intern(packed.data(), f.is_negated());
+}
+
+term_id term_table::intern(const block * row, bool neg) {
+  const size_t hash = hash_row(row, neg);
+  auto range = index.equal_range(hash);
+  for (auto it = range.first; it != range.second; it++) {
+    if (equal_row(it->second, row, neg)) return it->second;
+  }
+
+  const term_id id = size();
+  rows.insert(rows.end(), row, row + stride);
+  negated.push_back(neg);
+  index.emplace(hash, id);
+  return id;
+}
+
+boost::optional<term_id> term_table::find(const xor_func & f) const {
+  vector<block> packed;
+  pack(f, packed);
+
+  auto range = index.equal_range(hash_row(packed.data(), f.is_negated()));
+  for (auto it = range.first; it != range.second; it++) {
+    if (equal_row(it->second, packed.data(), f.is_negated())) return it->second;
+  }
+  return boost::none;
+}
+
+xor_func term_table::operator[](term_id i) const {
+  boost::dynamic_bitset<> bits(row(i), row(i) + stride);
+  bits.resize(length);
+  return xor_func(negated[i], bits);
+}
+
+size_t term_table::weight(term_id i) const {
+  size_t ret = 0;
+  for (size_t w = 0; w < stride; w++) {
+    ret += __builtin_popcountl(row(i)[w]);
+  }
+  return ret;
+}
+
+int term_table::highest_var(term_id i) const {
+  for (size_t w = stride; w-- > 0;) {
+    if (row(i)[w]) {
+      return w * boost::dynamic_bitset<>::bits_per_block
+        + (boost::dynamic_bitset<>::bits_per_block - 1 - __builtin_clzl(row(i)[w]));
+    }
+  }
+  return -1;
+}
+
+// Each pivot row is reduced by the ones before it, so a single pass over
+//   them in order leaves row reduced by the whole basis
+void term_table::reduce(const echelon & basis, block * row) const {
+  for (size_t p = 0; p < basis.size(); p++) {
+    if (row[basis.pivot_word[p]] & basis.pivot_bit[p]) {
+      const block * pivot = basis.rows.data() + p * stride;
+      for (size_t w = 0; w < stride; w++) row[w] ^= pivot[w];
+    }
+  }
+}
+
+// Adds row to the basis if it's independent of it. Clobbers row
+bool term_table::add_row(echelon & basis, vector<block> & row) const {
+  reduce(basis, row.data());
+  for (size_t w = 0; w < stride; w++) {
+    if (row[w]) {
+      basis.pivot_word.push_back(w);
+      basis.pivot_bit.push_back(row[w] & (~row[w] + 1));
+      basis.rows.insert(basis.rows.end(), row.begin(), row.end());
+      return true;
+    }
+  }
+  return false;
+}
+
+int term_table::rank(const term_set & st) const {
+  echelon basis;
+  vector<block> tmp(stride);
+
+  local_stats().rank_computations++;
+  basis.rows.reserve(st.size() * stride);
+  for (const term_id id : st) {
+    copy(row(id), row(id) + stride, tmp.begin());
+    add_row(basis, tmp);
+  }
+  return basis.size();
+}
+
+// Eliminates funcs once, then reduces all of the terms against the basis
+//   together, one pivot at a time
+term_set term_table::outside_span(const vector<term_id> & ids,
+    const vector<xor_func> & funcs) const {
+  echelon basis;
+  vector<block> tmp;
+  term_set ret;
+
+  local_stats().rank_computations++;
+  for (const xor_func & f : funcs) {
+    pack(f, tmp);
+    add_row(basis, tmp);
+  }
+
+  vector<block> batch(ids.size() * stride);
+  for (size_t i = 0; i < ids.size(); i++) {
+    copy(row(ids[i]), row(ids[i]) + stride, batch.data() + i * stride);
+  }
+  for (size_t p = 0; p < basis.size(); p++) {
+    const block * pivot = basis.rows.data() + p * stride;
+    const size_t word = basis.pivot_word[p];
+    const block bit = basis.pivot_bit[p];
+    for (block * cur = batch.data(); cur != batch.data() + batch.size(); cur += stride) {
+      if (cur[word] & bit) {
+        for (size_t w = 0; w < stride; w++) cur[w] ^= pivot[w];
+      }
+    }
+  }
+
+  for (size_t i = 0; i < ids.size(); i++) {
+    const block * cur = batch.data() + i * stride;
+    if (any_of(cur, cur + stride, [](block b) { return b != 0; })) ret.insert(ids[i]);
+  }
+  return ret;
+}
+
+vector<term_id> term_table::sort(const vector<bool> & keep) {
+  vector<term_id> order;
+  for (term_id i = 0; i < size(); i++) {
+    if (keep.empty() || keep[i]) order.push_back(i);
+  }
+  std::sort(order.begin(), order.end(), [this](term_id a, term_id b) {
+    return (*this)[a] < (*this)[b];
+  });
+
+  vector<term_id> renumber(size(), dropped);
+  vector<block> new_rows(order.size() * stride);
+  vector<bool> new_negated(order.size());
+  for (term_id i = 0; i < order.size(); i++) {
+    renumber[order[i]] = i;
+    copy(row(order[i]), row(order[i]) + stride, new_rows.data() + i * stride);
+    new_negated[i] = negated[order[i]];
+  }
+  rows.swap(new_rows);
+  negated.swap(new_negated);
+
+  index.clear();
+  for (term_id i = 0; i < size(); i++) {
+    index.emplace(hash_row(row(i), negated[i]), i);
+  }
+  return renumber;
+}
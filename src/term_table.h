@@ -0,0 +1,75 @@
+#ifndef TERM_TABLE_H
+#define TERM_TABLE_H
+
+#include <vector>
+#include <unordered_map>
+#include <boost/optional.hpp>
+
+#include "types.h"
+#include "xor_func.h"
+
+// Every distinct phase term of a circuit, stored once. Terms are referred to
+//   by a dense term_id everywhere else (Hadamard inputs, partitions, paths),
+//   and their bits live in a single packed matrix, one row per term.
+class term_table {
+  public:
+    using block = boost::dynamic_bitset<>::block_type;
+  private:
+    size_t length;                 // bits per term
+    size_t stride;                 // blocks per term
+    std::vector<block> rows;       // term i is rows[i*stride, (i+1)*stride)
+    std::vector<bool> negated;
+    std::unordered_multimap<size_t, term_id> index;   // hash of a term -> id
+
+    // Row echelon basis built up one row at a time, see add_row
+    struct echelon {
+      std::vector<block> rows;
+      std::vector<size_t> pivot_word;
+      std::vector<block> pivot_bit;
+      size_t size() const { return pivot_word.size(); }
+    };
+    void reduce(const echelon & basis, block * row) const;
+    bool add_row(echelon & basis, std::vector<block> & row) const;
+
+    size_t hash_row(const block * row, bool neg) const;
+    bool equal_row(term_id id, const block * row, bool neg) const;
+    void pack(const xor_func & f, std::vector<block> & out) const;
+  public:
+    term_table() : length(0), stride(0) {}
+    explicit term_table(size_t length);
+
+    // What sort maps dropped terms to
+    static constexpr term_id dropped = ~term_id(0);
+
+    size_t size() const { return negated.size(); }
+    size_t width() const { return length; }
+    size_t blocks() const { return stride; }
+
+    // Changes the number of bits in each term. Bits cut off must be 0
+    void resize(size_t length);
+
+    // Returns the id of f, adding it if it's new
+    term_id intern(const xor_func & f);
+    // Same, for a term already packed into blocks() blocks
+    term_id intern(const block * row, bool neg);
+    boost::optional<term_id> find(const xor_func & f) const;
+
+    xor_func operator[](term_id i) const;
+    const block * row(term_id i) const { return rows.data() + i * stride; }
+    bool is_negated(term_id i) const { return negated[i]; }
+    size_t weight(term_id i) const;
+    int highest_var(term_id i) const;
+
+    // Rank of a set of terms, ignoring negations
+    int rank(const term_set & st) const;
+    // The terms of ids outside the span of funcs, ignoring negations
+    term_set outside_span(const std::vector<term_id> & ids,
+        const std::vector<xor_func> & funcs) const;
+
+    // Renumbers the terms in the order of their xor_funcs, so sets of ids
+    //   iterate like the corresponding sets of xor_funcs. Terms i with
+    //   keep[i] false are removed, if keep is given. Returns the map from
+    //   old ids to new ones, or dropped.
+    std::vector<term_id> sort(const std::vector<bool> & keep = {});
+};
+#endif // TERM_TABLE_H
@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+
+#include "term_table.h"
+#include "util.h"
+
+using namespace std;
+
+TEST(termTable, intern) {
+    term_table terms(4);
+    xor_func a{false, {0,0,1,0}};
+    xor_func b{true, {0,0,1,0}};
+
+    term_id ia = terms.intern(a);
+    term_id ib = terms.intern(b);
+    EXPECT_NE(ia, ib);
+    EXPECT_EQ(ia, terms.intern(a));
+    EXPECT_EQ(2, terms.size());
+    EXPECT_EQ(a, terms[ia]);
+    EXPECT_EQ(b, terms[ib]);
+    EXPECT_TRUE(terms.is_negated(ib));
+
+    EXPECT_EQ(ib, *terms.find(b));
+    EXPECT_FALSE(terms.find(xor_func{false, {1,0,0,0}}));
+}
+
+TEST(termTable, queries) {
+    term_table terms(70);
+    xor_func f(70);
+    f.set(3);
+    f.set(66);
+    term_id id = terms.intern(f);
+
+    EXPECT_EQ(2, terms.weight(id));
+    EXPECT_EQ(66, terms.highest_var(id));
+}
+
+TEST(termTable, rank) {
+    term_table terms(4);
+    set<xor_func> funcs{
+        {false, {0,0,1,1}}, {false, {0,1,0,1}},
+        {true, {0,1,1,0}}, {false, {1,0,0,0}}};
+    term_set ids;
+    for (const xor_func & f : funcs) ids.insert(terms.intern(f));
+
+    EXPECT_EQ(compute_rank(funcs), terms.rank(ids));
+    EXPECT_EQ(3, terms.rank(ids));
+}
+
+TEST(termTable, sort) {
+    term_table terms(4);
+    vector<xor_func> funcs{
+        {false, {0,1,1,1}}, {false, {0,0,0,1}}, {false, {1,0,1,0}}};
+    vector<term_id> ids;
+    for (const xor_func & f : funcs) ids.push_back(terms.intern(f));
+
+    vector<term_id> renumber = terms.sort();
+    for (size_t i = 0; i < funcs.size(); i++) {
+        EXPECT_EQ(funcs[i], terms[renumber[ids[i]]]);
+        EXPECT_EQ(renumber[ids[i]], *terms.find(funcs[i]));
+    }
+    for (term_id i = 1; i < terms.size(); i++) {
+        EXPECT_TRUE(terms[i - 1] < terms[i]);
+    }
+}
+
+TEST(termTable, sortDropping) {
+    term_table terms(4);
+    term_id a = terms.intern({false, {0,1,1,1}});
+    term_id b = terms.intern({false, {0,0,0,1}});
+    term_id c = terms.intern({true, {1,0,1,0}});
+
+    vector<term_id> renumber = terms.sort({true, false, true});
+    EXPECT_EQ(2, terms.size());
+    EXPECT_EQ(term_table::dropped, renumber[b]);
+    EXPECT_EQ(xor_func(true, {1,0,1,0}), terms[renumber[c]]);
+    EXPECT_EQ(renumber[a], *terms.find({false, {0,1,1,1}}));
+    EXPECT_FALSE(terms.find({false, {0,0,0,1}}));
+    EXPECT_TRUE(terms[0] < terms[1]);
+}
+
+TEST(termTable, outsideSpan) {
+    term_table terms(4);
+    vector<term_id> ids{
+        terms.intern({false, {1,1,0,0}}), terms.intern({true, {0,1,1,0}}),
+        terms.intern({false, {0,0,0,1}}), terms.intern({false, {1,0,1,0}})};
+    vector<xor_func> wires{
+        {false, {1,0,0,0}}, {true, {0,1,0,0}}, {false, {0,0,0,0}}};
+
+    EXPECT_EQ((term_set{ids[1], ids[2], ids[3]}), terms.outside_span(ids, wires));
+
+    wires[2] = {false, {0,0,1,0}};
+    EXPECT_EQ((term_set{ids[2]}), terms.outside_span(ids, wires));
+}
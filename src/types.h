@@ -5,6 +5,11 @@
 #include <list>
 #include <map>
 #include <set>
+#include <cstdint>
+#include <algorithm>
+#include <initializer_list>
+#include <cassert>
+#include <functional>
 
 class xor_func;
 
@@ -12,11 +17,49 @@ using exponent_val = unsigned char;
 using exponent = std::pair<xor_func, exponent_val>;
 using exponents_set = std::map<xor_func, exponent_val>;
 
-// [(Str, [Str])]
-using gatelist = std::list<std::pair<std::string, std::list<std::string>>>;
+// Index of a phase term in a term_table
+using term_id = uint32_t;
+using term_set = std::set<term_id>;
 
-using partitioning = std::list<std::set<xor_func>>;
-using path_iterator = std::list<std::pair<xor_func, partitioning::iterator>>::iterator;
+// The gates of a .qc circuit. TOF is a CNOT on two qubits, an X on one.
+//   SWAP exchanges two wires; only synthesis makes it, and relabel_swaps
+//   takes it out again before a circuit is written
+enum class gate_type : unsigned char { H, X, Y, Z, P, P_DAG, T, T_DAG, TOF, SWAP };
 
-enum synth_type { AD_HOC, GAUSS, PMH };
+// A gate on at most three qubits, each given by its index in the circuit's
+//   names, in the order they're written
+struct gate {
+  gate_type type;
+  unsigned char size;
+  int wires[3];
+
+  gate() : type(gate_type::H), size(0), wires{0, 0, 0} {}
+  gate(gate_type type, std::initializer_list<int> qubits) : type(type), size(0), wires{0, 0, 0} {
+    assert(qubits.size() <= 3);
+    for (int q : qubits) wires[size++] = q;
+  }
+
+  int * begin() { return wires; }
+  int * end() { return wires + size; }
+  const int * begin() const { return wires; }
+  const int * end() const { return wires + size; }
+
+  bool operator==(const gate & other) const {
+    return type == other.type && size == other.size
+      && std::equal(begin(), end(), other.begin());
+  }
+  bool operator!=(const gate & other) const { return !(*this == other); }
+};
+
+using gatelist = std::vector<gate>;
+// Takes gates one at a time, as they're made, e.g. to write or count them
+//   without keeping the circuit
+using gate_sink = std::function<void(const gate &)>;
+
+using partitioning = std::list<term_set>;
+using path_iterator = std::list<std::pair<term_id, partitioning::iterator>>::iterator;
+
+enum synth_type { AD_HOC, GAUSS, PMH, PORTFOLIO };
+// Order in which newly available terms are handed to the partitioner
+enum order_type { ORDER_NATURAL, ORDER_WEIGHT, ORDER_HIGHEST_VAR, ORDER_OVERLAP, ORDER_RANDOM };
 #endif // TYPES_H
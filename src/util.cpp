@@ -23,12 +23,21 @@ Author: Matthew Amy
 #include <cmath>
 #include <cassert>
 #include <stdexcept>
+#include <chrono>
+#include <sstream>
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
 
 #include <boost/lexical_cast.hpp>
 
 #include "util.h"
 #include "xor_func.h"
 #include "oracle.h"
+#include "stats.h"
+#include "cnot_cache.h"
+#include "worker_pool.h"
+#include "dotqc.h"
 
 using namespace std;
 
@@ -45,21 +54,19 @@ void print_wires(const vector<xor_func>& wires) {
   }
 }
 
-// Commands for making certain circuits
-gatelist xor_com(int a, int b, const vector<string> names) {
-  return {{"tof", {names[a], names[b]}}};
+// Commands for making certain circuits, appended to acc
+void xor_com(gatelist & acc, int a, int b) {
+  acc.push_back(gate(gate_type::TOF, {a, b}));
 }
 
-gatelist swap_com(int a, int b, const vector<string> names) {
-  return {
-      {"tof", {names[a], names[b]}},
-      {"tof", {names[b], names[a]}},
-      {"tof", {names[a], names[b]}},
-  };
+// A swap costs nothing until relabel_swaps, which only pays for the wires
+//   still out of place at the end
+void swap_com(gatelist & acc, int a, int b) {
+  acc.push_back(gate(gate_type::SWAP, {a, b}));
 }
 
-gatelist x_com(int a, const vector<string> names) {
-  return {{"X", {names[a]}}};
+void x_com(gatelist & acc, int a) {
+  acc.push_back(gate(gate_type::X, {a}));
 }
 
 // TODO, can this just use to_upper_echelon?
@@ -67,6 +74,8 @@ gatelist x_com(int a, const vector<string> names) {
 int compute_rank_dest(vector<xor_func> tmp) {
   int rank = 0;
 
+  local_stats().rank_computations++;
+
   if(tmp.size() == 0) { return 0; } // Empty vector has 0 rank
   int func_size = tmp.at(0).size() ;  // - 1?
   // Make triangular
@@ -182,19 +191,18 @@ int to_upper_echelon_mut(int m, int n,
 
 // Const version only, since that's the only one used.
 gatelist to_upper_echelon(int m, int n,
-        const vector<xor_func>& bits,
-        const vector<string>& names) {
+        const vector<xor_func>& bits) {
   gatelist acc;
   vector<xor_func> tmp{bits};
   to_upper_echelon_mut(m, n, tmp,
-          [&acc, &names](int j){
-            acc.splice(acc.end(), x_com(j, names));
+          [&acc](int j){
+            x_com(acc, j);
           },
-          [&acc, &names](int r1, int r2){
-            acc.splice(acc.end(), swap_com(r1, r2, names));
+          [&acc](int r1, int r2){
+            swap_com(acc, r1, r2);
           },
-          [&acc, &names](int target, int i){
-            acc.splice(acc.end(), xor_com(target, i, names));
+          [&acc](int target, int i){
+            xor_com(acc, target, i);
           });
   return acc;
 }
@@ -267,12 +275,12 @@ void backfill_matrix(int m, int n,
     }
 }
 
-gatelist to_lower_echelon(const int m, const int n, vector<xor_func>& bits, const vector<string> names) {
+gatelist to_lower_echelon(const int m, const int n, vector<xor_func>& bits) {
     gatelist acc;
 
     backfill_matrix(m, n, bits,
-            [&acc, &names](int i, int j) {
-                acc.splice(acc.end(), xor_com(i, j, names));
+            [&acc](int i, int j) {
+                xor_com(acc, i, j);
             });
     return acc;
 }
@@ -286,35 +294,70 @@ void to_lower_echelon(const int m, const int n, vector<xor_func>& bits, vector<x
 
 gatelist fix_basis(int m, int n,
         const vector<xor_func>& fst,
+        const echelon_pivots& pivots,
         vector<xor_func>& snd,
         std::function<void(int, int)> do_swap,
         std::function<void(int, int)> do_xor);
 // Fixed interface versions
 gatelist
+fix_basis(int m, int n,
+        const vector<xor_func>& fst,
+        vector<xor_func>& snd);
+void
 fix_basis(int m, int n,
         const vector<xor_func>& fst,
         vector<xor_func>& snd,
-        const vector<string>& names);
+        vector<xor_func>& mat);
+// With the pivots of fst already found
+gatelist
+fix_basis(int m, int n,
+        const vector<xor_func>& fst,
+        const echelon_pivots& pivots,
+        vector<xor_func>& snd);
 void
 fix_basis(int m, int n,
         const vector<xor_func>& fst,
+        const echelon_pivots& pivots,
         vector<xor_func>& snd,
         vector<xor_func>& mat);
 
+// The first bit set in row at or after j, or n if there's none
+static int next_bit(const boost::dynamic_bitset<> & row, int j, int n) {
+  const size_t b = j == 0 ? row.find_first() : row.find_next(j - 1);
+  return b == boost::dynamic_bitset<>::npos || b >= (size_t)n ? n : (int)b;
+}
+
+echelon_pivots::echelon_pivots(int m, int n, const vector<xor_func>& mat) :
+  col(m, n),
+  row(n, -1)
+{
+  int j = 0;
+  for (int i = 0; i < m; i++) {
+    j = next_bit(mat[i].bits(), j, n);
+    col[i] = j;
+    if (j < n) row[j] = i;
+  }
+}
+
 // Implementations
 gatelist fix_basis(int m, int n,
         const vector<xor_func>& fst,
-        vector<xor_func>& snd,
-        const vector<string>& names) {
+        vector<xor_func>& snd) {
+    return fix_basis(m, n, fst, echelon_pivots(m, n, fst), snd);
+}
+gatelist fix_basis(int m, int n,
+        const vector<xor_func>& fst,
+        const echelon_pivots& pivots,
+        vector<xor_func>& snd) {
     gatelist acc;
-    fix_basis(m, n, fst, snd,
-          [&acc, &names](int r1, int r2){
-            acc.splice(acc.end(), swap_com(r1, r2, names));
+    fix_basis(m, n, fst, pivots, snd,
+          [&acc](int r1, int r2){
+            swap_com(acc, r1, r2);
           },
-          [&acc, &names](int target, int i){
+          [&acc](int target, int i){
             // The existing code did swap the two, I'm not sure why
             // I guess I need more tests
-            acc.splice(acc.end(), xor_com(i, target, names));
+            xor_com(acc, i, target);
           });
     return acc;
 }
@@ -322,7 +365,14 @@ void fix_basis(int m, int n,
         const vector<xor_func>& fst,
         vector<xor_func>& snd,
         vector<xor_func>& mat) {
-    fix_basis(m, n, fst, snd,
+    fix_basis(m, n, fst, echelon_pivots(m, n, fst), snd, mat);
+}
+void fix_basis(int m, int n,
+        const vector<xor_func>& fst,
+        const echelon_pivots& pivots,
+        vector<xor_func>& snd,
+        vector<xor_func>& mat) {
+    fix_basis(m, n, fst, pivots, snd,
           [&mat](int r1, int r2){
             swap(mat[r1], mat[r2]);
           },
@@ -331,26 +381,26 @@ void fix_basis(int m, int n,
           });
 }
 // Expects two matrices in echelon form, the second being a subset of the
-//   rowspace of the first. It then morphs the second matrix into the first
+//   rowspace of the first, and the pivots of the first. It then morphs the
+//   second matrix into the first
 gatelist fix_basis(int m, int n,
         const vector<xor_func>& fst,
+        const echelon_pivots& pivots,
         vector<xor_func>& snd,
         std::function<void(int, int)> do_swap,
         std::function<void(int, int)> do_xor){
 
-  int k = compute_rank(snd);
+  // snd is in echelon form, so its rank is the rows left above the zero ones
+  int k = m;
+  while (k > 0 && snd[k - 1].none()) k--;
   gatelist acc;
   int j = 0;
   bool flg = false;
-  map<int, int> pivots;  // mapping from columns to rows that have that column as pivot
-  for (int i = 0; i < n; i++) pivots[i] = -1;
 
   // First pass makes sure tmp has the same pivots as fst
   for (int i = 0; i < m; i++) {
-    // Find the next pivot
-    while (j < n && !fst[i].test(j)) j++;
+    j = pivots.col[i];
     if (j < n) {
-      pivots[j] = i;
       flg = false;
       for (int h = i; !flg && h < k; h++) {
         // We found a vector with the same pivot
@@ -382,21 +432,24 @@ gatelist fix_basis(int m, int n,
     }
   }
 
-  // Second pass makes each row of tmp equal to that row of fst
+  // Second pass makes each row of tmp equal to that row of fst. diff is
+  //   kept to where the rows still differ, so only those bits are visited
+  boost::dynamic_bitset<> diff;
   for (int i = 0; i < m; i++) {
-    for (int j = i +1; j < n; j++) {
-      if (fst[i][j] != snd[i][j]) {
-        if (pivots[j] == -1) {
-          cout << "FATAL ERROR: cannot fix basis\n" << flush;
-          cout << "fst" << endl << fst;
-          cout << "snd" << endl << snd;
-          assert(false);
-        } else {
-          snd[i] ^= snd[pivots[j]];
-          do_xor(i, pivots[j]);
-          /* if (! has_mat) acc.splice(acc.end(), xor_com(pivots[j], i, names)); */
-          /* else           mat[i] ^= mat[pivots[j]]; */
-        }
+    diff = fst[i].bits();
+    diff ^= snd[i].bits();
+    for (j = next_bit(diff, i + 1, n); j < n; j = next_bit(diff, j + 1, n)) {
+      if (pivots.row[j] == -1) {
+        cout << "FATAL ERROR: cannot fix basis\n" << flush;
+        cout << "fst" << endl << fst;
+        cout << "snd" << endl << snd;
+        assert(false);
+      } else {
+        snd[i] ^= snd[pivots.row[j]];
+        diff ^= snd[pivots.row[j]].bits();
+        do_xor(i, pivots.row[j]);
+        /* if (! has_mat) acc.splice(acc.end(), xor_com(pivots[j], i, names)); */
+        /* else           mat[i] ^= mat[pivots[j]]; */
       }
     }
     if (!(snd[i] == fst[i])) {
@@ -420,15 +473,16 @@ void compose(int num, vector<xor_func>& A, const vector<xor_func>& B) {
 //------------------------- CNOT synthesis methods
 
 // Gaussian elimination based CNOT synthesis
-gatelist gauss_CNOT_synth(int n, int m, vector<xor_func> bits, const vector<string> names) {
+// The gates are found last to first, so they're appended and reversed at
+//   the end
+gatelist gauss_CNOT_synth(int n, int m, vector<xor_func> bits) {
   int i, j, k;
   gatelist lst;
-  list<string> tmp_list1, tmp_list2;
 
   for (j = 0; j < n; j++) {
-    if (bits[j].test(n)) {
-      bits[j].reset(n);
-      lst.splice(lst.begin(), x_com(j, names));
+    if (bits[j].is_negated()) {
+      bits[j].negate();
+      x_com(lst, j);
     }
   }
 
@@ -442,12 +496,12 @@ gatelist gauss_CNOT_synth(int n, int m, vector<xor_func> bits, const vector<stri
           // If it wasn't the first vector we tried, swap to the front
           if (j != i) {
             swap(bits[i], bits[j]);
-            lst.splice(lst.begin(), swap_com(i, j, names));
+            swap_com(lst, i, j);
           }
           flg = true;
         } else {
           bits[j] ^= bits[i];
-          lst.splice(lst.begin(), xor_com(i, j, names));
+          xor_com(lst, j, i);
         }
       }
     }
@@ -462,75 +516,161 @@ gatelist gauss_CNOT_synth(int n, int m, vector<xor_func> bits, const vector<stri
     for (j = i - 1; j >= 0; j--) {
       if (bits[j].test(i)) {
         bits[j] ^= bits[i];
-        lst.splice(lst.begin(), xor_com(i, j, names));
+        xor_com(lst, j, i);
       }
     }
   }
 
+  reverse(lst.begin(), lst.end());
   return lst;
 }
 
-// Patel/Markov/Hayes CNOT synthesis
-gatelist Lwr_CNOT_synth(int n, int m, vector<xor_func>& bits, const vector<string>& names, bool rev) {
+// Patel/Markov/Hayes CNOT synthesis. With rev the gates come out last to
+//   first
+gatelist Lwr_CNOT_synth(int n, int m, vector<xor_func>& bits, bool rev) {
   gatelist acc;
-  int patt[1<<m];
-
-  // Use doubles with ceil?
-  for (int sec = 0; sec < ceil(n / m); sec++) {
-
-    for (int i = 0; i < (1<<m); i++) {
-      patt[i] = -1;
-    }
+  // First row of each pattern in the section. Narrow sections index a table
+  //   of every pattern, reset only where it was set; wider ones only keep
+  //   the patterns that come up
+  const bool table = m <= 16;
+  vector<int> patt(table ? 1 << m : 0, -1);
+  unordered_map<unsigned long, int> wide;
+  vector<unsigned long> slices(n);
+
+  for (int sec = 0; sec * m < n; sec++) {
     for (int row = sec*m; row < n; row++) {
-      int tmp = bits[row].slice(sec*m, m);
-      if (patt[tmp] == -1) {
-        /* cout << "Setting patt[" << tmp << "] to row " << row << endl; */
-        patt[tmp] = row;
+      const unsigned long tmp = slices[row] = bits[row].slice(sec*m, m);
+      int & first = table ? patt[tmp] : wide.emplace(tmp, -1).first->second;
+      if (first == -1) {
+        first = row;
       } else if (tmp != 0) {
-        bits[row] ^= bits[patt[tmp]];
+        bits[row] ^= bits[first];
         // Step A
-        /* cout << "Setting " << names[row] << " to " << names[row] << " + " << names[patt[tmp]] << endl; */
-        if (rev) acc.splice(acc.begin(), xor_com(patt[tmp], row, names));
-        else acc.splice(acc.end(), xor_com(row, patt[tmp], names));
+        if (rev) xor_com(acc, first, row);
+        else xor_com(acc, row, first);
       }
     }
+    if (table) {
+      for (int row = sec*m; row < n; row++) patt[slices[row]] = -1;
+    } else {
+      wide.clear();
+    }
 
-    for (int col = sec*m; col < (sec+1)*m; col++) {
-      bool one_diag = bits[col].test(col);
+    for (int col = sec*m; col < min((sec+1)*m, n); col++) {
       for (int row=col + 1; row < n; row++) {
         if (bits[row].test(col)) {
-          if (not(one_diag)) {
+          // With sections wider than 1 bit, several rows below may still
+          //   have this column set
+          if (not(bits[col].test(col))) {
             // Step B
             bits[col] ^= bits[row];
             if (rev) {
-              acc.splice(acc.begin(), xor_com(row, col, names));
+              xor_com(acc, row, col);
             } else {
-              acc.splice(acc.end(), xor_com(col, row, names));
+              xor_com(acc, col, row);
             }
           }
           // Step C
           bits[row] ^= bits[col];
-          if (rev) acc.splice(acc.begin(), xor_com(col, row, names));
-          else acc.splice(acc.end(), xor_com(row, col, names));
+          if (rev) xor_com(acc, col, row);
+          else xor_com(acc, row, col);
         }
       }
     }
   }
 
+  if (rev) reverse(acc.begin(), acc.end());
   return acc;
 }
 
 // Split up to allow overridding the number of segments in test code
 // to match the example in the paper.
-gatelist CNOT_synth(int n, int num_segments, vector<xor_func>& bits, const vector<string> names);
+gatelist CNOT_synth(int n, int num_segments, vector<xor_func>& bits);
+
+map<int, int> pmh_sections;
+function<void(const vector<xor_func>&)> pmh_observer;
+
+int pmh_section_size(int n) {
+  auto it = pmh_sections.upper_bound(n);
+  if (it == pmh_sections.begin()) return 0;
+  return max(1, min(prev(it)->second, n));
+}
+
+bool read_pmh_sections(istream & in, map<int, int> & sections) {
+  string line;
+  while (getline(in, line)) {
+    line = line.substr(0, line.find('#'));
+    istringstream fields(line);
+    int n, m;
+    if (!(fields >> n)) continue;
+    if (!(fields >> m) || n < 1 || m < 1 || m > max_pmh_section) return false;
+    sections[n] = m;
+  }
+  return true;
+}
+
+void write_pmh_sections(ostream & out, const map<int, int> & sections) {
+  out << "# PMH section size for each matrix size, from --tune-pmh\n";
+  for (const auto& entry : sections) {
+    out << entry.first << " " << entry.second << "\n";
+  }
+}
+
+map<int, int> tune_pmh(const vector<vector<xor_func>> & mats, int max_m, ostream & log) {
+  // CNOTs and seconds for each section size, by matrix size
+  map<int, vector<pair<size_t, double>>> cost;
+  for (const auto& mat : mats) {
+    const int n = mat.size();
+
+    auto& costs = cost[n];
+    costs.resize(min(n, max_m));
+    for (int m = 1; m <= (int)costs.size(); m++) {
+      vector<xor_func> bits = mat;
+      const auto start = chrono::steady_clock::now();
+      const gatelist gates = CNOT_synth(n, m, bits);
+      costs[m - 1].first += gates.size();
+      costs[m - 1].second += chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+  }
+
+  map<int, int> ret;
+  for (const auto& entry : cost) {
+    const auto& costs = entry.second;
+    int best = 0;
+    log << "# PMH " << entry.first << "x" << entry.first << ":";
+    for (size_t i = 0; i < costs.size(); i++) {
+      log << " m=" << i + 1 << " " << costs[i].first << " gates " << costs[i].second << " s;";
+      if (costs[i].first < costs[best].first) best = i;
+    }
+    log << " using " << best + 1 << "\n";
+    ret[entry.first] = best + 1;
+  }
+  return ret;
+}
 
-gatelist CNOT_synth(int n, vector<xor_func>& bits, const vector<string> names) {
-  int m = round(log((double)n) / (log(2) * 2));
-  m = min(m, 1);
-  return CNOT_synth(n, m, bits, names);
+gatelist CNOT_synth(int n, vector<xor_func>& bits) {
+  if (pmh_observer) pmh_observer(bits);
+  const int tuned = pmh_section_size(n);
+  if (tuned != 0) return CNOT_synth(n, tuned, bits);
+
+  // Sections of log(n)/2 bits are only best asymptotically, so smaller ones
+  //   are tried too and the shortest circuit kept
+  const int m = min(max_pmh_section, (int)round(log((double)n) / (log(2) * 2)));
+  gatelist best;
+  vector<xor_func> best_bits;
+  for (int i = 1; i <= max(m, 1); i++) {
+    vector<xor_func> tmp = bits;
+    gatelist gates = CNOT_synth(n, i, tmp);
+    if (i == 1 || gates.size() < best.size()) {
+      best = move(gates);
+      best_bits = move(tmp);
+    }
+  }
+  bits = move(best_bits);
+  return best;
 }
 
-gatelist CNOT_synth(int n, int num_segments, vector<xor_func>& bits, const vector<string> names) {
+gatelist CNOT_synth(int n, int num_segments, vector<xor_func>& bits) {
   gatelist acc, tmp;
   int i, j;
   const int m = num_segments;
@@ -541,36 +681,182 @@ gatelist CNOT_synth(int n, int num_segments, vector<xor_func>& bits, const vecto
   for (j = 0; j < n; j++) {
     if (bits[j].is_negated()) {
       bits[j].negate();
-      acc.splice(acc.begin(), x_com(j, names));
+      x_com(acc, j);
     }
   }
+  reverse(acc.begin(), acc.end());
 
-  acc.splice(acc.end(), Lwr_CNOT_synth(n, m, bits, names, false));
+  tmp = Lwr_CNOT_synth(n, m, bits, false);
+  acc.insert(acc.end(), tmp.begin(), tmp.end());
   for (i = 0; i < n; i++) {
     for (j = i + 1; j < n; j++) {
       bits[j].set(i, bits[i][j]); // Transpose
       bits[i].reset(j);
     }
   }
-  acc.splice(acc.end(), Lwr_CNOT_synth(n, m, bits, names, true));
-  acc.reverse();
+  tmp = Lwr_CNOT_synth(n, m, bits, true);
+  acc.insert(acc.end(), tmp.begin(), tmp.end());
+  reverse(acc.begin(), acc.end());
 
   return acc;
 }
 
+// Runs body(0), ..., body(count - 1), spread over the shared workers when
+//   there are enough of them to be worth it
+static void for_each_index(size_t count, function<void(size_t)> body) {
+  if (count < 4) {
+    for (size_t i = 0; i < count; i++) body(i);
+    return;
+  }
+  shared_workers().run(count, body);
+}
+
+// Gates left of a circuit once relabel_swaps has taken its swaps out
+static size_t cost_without_swaps(const gatelist & gates) {
+  return count_if(gates.begin(), gates.end(),
+      [](const gate & g) { return g.type != gate_type::SWAP; });
+}
+
+// Synthesizes bits with Gaussian elimination and with PMH at sections of 1
+//   to 4 bits, at once, and keeps the circuit with the fewest gates after
+//   post-processing. winner is set to the method that gave it
+static gatelist portfolio_CNOT_synth(int n, const vector<xor_func> & bits,
+    string & winner) {
+  vector<gatelist> results(1 + min(n, 4));
+  for_each_index(results.size(), [&](size_t i) {
+    vector<xor_func> tmp = bits;
+    if (i == 0) results[i] = gauss_CNOT_synth(n, 0, tmp);
+    else results[i] = CNOT_synth(n, i, tmp);
+  });
+
+  vector<size_t> costs;
+  for (const gatelist & result : results) costs.push_back(cost_without_swaps(result));
+  size_t best = 0;
+  for (size_t i = 1; i < results.size(); i++) {
+    if (costs[i] < costs[best]) best = i;
+  }
+  winner = best == 0 ? "GAUSS" : "PMH" + to_string(best);
+  return move(results[best]);
+}
+
+// Appends the gates applying phase to the terms of p, prepared in the first
+//   p.size() wires
+static void apply_phases(const term_set & p, const vector<exponent_val> & phase,
+    gatelist & ret) {
+  auto ti = p.begin();
+  for (int i = 0; ti != p.end(); ti++, i++) {
+    if (phase.at(*ti) <= 4) {
+      if (phase.at(*ti) / 4 == 1) ret.push_back(gate(gate_type::Z, {i}));
+      if (phase.at(*ti) / 2 == 1) ret.push_back(gate(gate_type::P, {i}));
+      if (phase.at(*ti) % 2 == 1) ret.push_back(gate(gate_type::T, {i}));
+    } else {
+      if (phase.at(*ti) == 5 ||
+          phase.at(*ti) == 6) ret.push_back(gate(gate_type::P_DAG, {i}));
+      if (phase.at(*ti) % 2 == 1) ret.push_back(gate(gate_type::T_DAG, {i}));
+    }
+  }
+}
+
+// construct_circuit for the matrix based methods. The basis each partition
+//   (and finally out) is prepared in depends only on it and on in, and the
+//   CNOTs between two of them only on the pair, so they're all found
+//   independently before the layers are strung together
+static gatelist construct_layers(
+        const term_table & terms,
+        const vector<exponent_val> & phase,
+        const partitioning & part,
+        const layer_context & in,
+        const vector<xor_func> & out,
+        const int num,
+        const int dim) {
+  vector<const term_set *> parts;
+  for (const auto& p : part) parts.push_back(&p);
+
+  // bases[k] takes in to the bits of partition k, or of out for the last
+  vector<vector<xor_func>> bases(parts.size() + 1);
+  for_each_index(bases.size(), [&](size_t k) {
+    vector<xor_func> bits;
+    if (k < parts.size()) {
+      for (const term_id id : *parts[k]) bits.emplace_back(terms[id]);
+      while (bits.size() < (size_t)num) bits.emplace_back(dim);
+    } else {
+      bits = out;
+      extend_row_length(bits, dim);
+    }
+
+    vector<xor_func> & post = bases[k];
+    post = in.identity;
+    to_upper_echelon_mut(num, dim, bits, post);
+    fix_basis(num, dim, in.in, in.pivots, bits, post);
+  });
+
+  // The CNOTs from each basis to the next
+  vector<gatelist> cnots(bases.size());
+  for_each_index(bases.size(), [&](size_t k) {
+    vector<xor_func> mat = k == 0 ? in.pre : bases[k - 1];
+    compose(num, mat, bases[k]);
+    // Counted here rather than by the portfolio, so cache hits count too
+    string winner;
+    cnots[k] = cnot_memo().synthesize(synth_method, mat,
+        [num](vector<xor_func> & bits, string & winner) {
+          if (synth_method == GAUSS) return gauss_CNOT_synth(num, 0, bits);
+          if (synth_method == PORTFOLIO) return portfolio_CNOT_synth(num, bits, winner);
+          return CNOT_synth(num, bits);
+        }, &winner);
+    if (!winner.empty()) local_stats().add_win(winner);
+  });
+
+  gatelist ret;
+  for (size_t k = 0; k < parts.size(); k++) {
+    ret.insert(ret.end(), cnots[k].begin(), cnots[k].end());
+    apply_phases(*parts[k], phase, ret);
+  }
+  ret.insert(ret.end(), cnots.back().begin(), cnots.back().end());
+  return ret;
+}
+
+layer_context::layer_context(const vector<xor_func> & wires, int num, int dim) :
+  wires(wires),
+  in(wires)
+{
+  for (int i = 0; i < num; i++) {
+    identity.emplace_back(num);
+    identity[i].set(i);
+  }
+
+  // Reduce in to echelon form to decide on a basis
+  if (synth_method == AD_HOC) reduce = to_upper_echelon(num, dim, in);
+  else {
+      pre = identity;
+      to_upper_echelon_mut(num, dim, in, pre);
+  }
+  pivots = echelon_pivots(num, dim, in);
+}
+
+gatelist construct_circuit(
+        const term_table & terms,
+        const vector<exponent_val> & phase,
+        const partitioning & part,
+        const vector<xor_func> & in,
+        const vector<xor_func>& out,
+        const int num,
+        const int dim) {
+  return construct_circuit(terms, phase, part, layer_context(in, num, dim),
+      out, num, dim);
+}
+
 // Construct a circuit for a given partition
 gatelist construct_circuit(
-        const exponents_set & phase,
+        const term_table & terms,
+        const vector<exponent_val> & phase,
         const partitioning & part,
-        vector<xor_func> in,  // Copy and mutate this
+        const layer_context & in,
         const vector<xor_func>& out,
         const int num,
-        const int dim,
-        const vector<string>& names) {
+        const int dim) {
   gatelist ret, tmp, rev;
-  vector<xor_func> pre, post;
 
-  assert(in.size() == num);
+  assert(in.wires.size() == num);
   if(out.size() != num) {
       cout << "out.size() = " << out.size() << endl;
       cout << "num = " << num << endl;
@@ -579,25 +865,11 @@ gatelist construct_circuit(
   // flg = forall i. in[i] == out[i]
   bool ins_equal_outs = true;
   for (int i = 0; i < num; i++) {
-    ins_equal_outs &= (in[i] == out[i]);
+    ins_equal_outs &= (in.wires[i] == out[i]);
   }
 
-  if (synth_method != AD_HOC) {
-      // Create two identity matricies
-      for (int i = 0; i < num; i++) {
-          pre.emplace_back(num);
-          post.emplace_back(num);
-          pre[i].set(i);
-          post[i].set(i);
-      }
-  }
   if (ins_equal_outs && (part.size() == 0)) return ret;
-
-  // Reduce in to echelon form to decide on a basis
-  if (synth_method == AD_HOC) ret.splice(ret.end(), to_upper_echelon(num, dim, in, names));
-  else {
-      to_upper_echelon_mut(num, dim, in, pre);
-  }
+  if (synth_method == AD_HOC) ret = in.reduce;
 
   if(disp_log) cerr << "Partition is" << endl;
   {
@@ -606,94 +878,92 @@ gatelist construct_circuit(
     tmp++;
     if(disp_log) cerr << "Part " << tmp << " of " << part.size() << endl;
     vector<xor_func> arr;
-    for (const xor_func& f : p) {
-        arr.push_back(f);
+    for (const term_id id : p) {
+        arr.push_back(terms[id]);
     }
     if(disp_log) cerr << arr;
   }
   }
+  if (synth_method != AD_HOC) {
+    tmp = construct_layers(terms, phase, part, in, out, num, dim);
+    ret.insert(ret.end(), tmp.begin(), tmp.end());
+    return ret;
+  }
+
   // For each partition... Compute *it, apply T gates, uncompute
   for (partitioning::const_iterator it = part.begin(); it != part.end(); it++) {
     vector<xor_func> bits;
-    {
-        int i = 0;
-        for(const xor_func& f : *it) {
-            bits.emplace_back(f);
-            i++;
-        }
-        for(; i < num; i++) {
-            bits.emplace_back(dim);
-        }
-    }
+    for (const term_id id : *it) bits.emplace_back(terms[id]);
+    while (bits.size() < (size_t)num) bits.emplace_back(dim);
 
     // prepare the bits
-    if (synth_method == AD_HOC) {
-      tmp = to_upper_echelon(it->size(), dim, bits, names);
-      tmp.splice(tmp.end(), fix_basis(num, dim, in, bits, names));
-      rev = tmp;
-      rev.reverse();
-      ret.splice(ret.end(), rev);
-    } else {
-      /* cout << "Bits size is " << bits.size() << endl; */
-      /* cout << bits; */
-      to_upper_echelon_mut(num, dim, bits, post);
-      fix_basis(num, dim, in, bits, post);
-      compose(num, pre, post);
-      if (synth_method == GAUSS) ret.splice(ret.end(), gauss_CNOT_synth(num, 0, pre, names));
-      else if (synth_method == PMH) ret.splice(ret.end(), CNOT_synth(num, pre, names));
-    }
+    tmp = to_upper_echelon(it->size(), dim, bits);
+    rev = fix_basis(num, dim, in.in, in.pivots, bits);
+    tmp.insert(tmp.end(), rev.begin(), rev.end());
+    ret.insert(ret.end(), tmp.rbegin(), tmp.rend());
 
-    // apply the T gates
-    auto ti = it-> begin();
-    for (int i = 0; ti != it->end(); ti++, i++) {
-      const list<string> tmp_lst{names[i]};
-      if (phase.at(*ti) <= 4) {
-        if (phase.at(*ti) / 4 == 1) ret.emplace_back("Z", tmp_lst);
-        if (phase.at(*ti) / 2 == 1) ret.emplace_back("P", tmp_lst);
-        if (phase.at(*ti) % 2 == 1) ret.emplace_back("T", tmp_lst);
-      } else {
-        if (phase.at(*ti) == 5 ||
-            phase.at(*ti) == 6) ret.emplace_back("P*", tmp_lst);
-        if (phase.at(*ti) % 2 == 1) ret.emplace_back("T*", tmp_lst);
-      }
-    }
+    apply_phases(*it, phase, ret);
 
     // unprepare the bits
-    if (synth_method == AD_HOC) ret.splice(ret.end(), tmp);
-    else {
-      pre = post;
-      // re-initialize post
-      for (int i = 0; i < num; i++) {
-        post[i] = xor_func(num);
-        post[i].set(i);
-      }
-    }
+    ret.insert(ret.end(), tmp.begin(), tmp.end());
   }
 
   {
-    vector<xor_func> bits;
+    vector<xor_func> bits = out;
     // Reduce out to the basis of in
-    for (int i = 0; i < num; i++) {
-        bits.push_back(out[i]);
-    }
     extend_row_length(bits, dim);
-    if (synth_method == AD_HOC) {
-        tmp = to_upper_echelon(num, dim, bits, names);
-        tmp.splice(tmp.end(), fix_basis(num, dim, in, bits, names));
-        tmp.reverse();
-        ret.splice(ret.end(), tmp);
-    } else {
-        to_upper_echelon_mut(num, dim, bits, post);
-        fix_basis(num, dim, in, bits, post);
-        compose(num, pre, post);
-        if (synth_method == GAUSS) ret.splice(ret.end(), gauss_CNOT_synth(num, 0, pre, names));
-        else if (synth_method == PMH) ret.splice(ret.end(), CNOT_synth(num, pre, names));
-    }
+    tmp = to_upper_echelon(num, dim, bits);
+    rev = fix_basis(num, dim, in.in, in.pivots, bits);
+    tmp.insert(tmp.end(), rev.begin(), rev.end());
+    ret.insert(ret.end(), tmp.rbegin(), tmp.rend());
   }
 
   return ret;
 }
 
+void relabel_swaps(gatelist & gates, int num) {
+  gatelist ret;
+  swap_relabeler relabel(num, [&ret](const gate & g) { ret.push_back(g); });
+  for (const gate & g : gates) relabel.push(g);
+  relabel.finish();
+  gates = move(ret);
+}
+
+swap_relabeler::swap_relabeler(int num, gate_sink emit) :
+  wire(num),
+  logical(num),
+  emit(emit)
+{
+  iota(wire.begin(), wire.end(), 0);
+  iota(logical.begin(), logical.end(), 0);
+}
+
+void swap_relabeler::push(const gate & g) {
+  if (g.type == gate_type::SWAP) {
+    swap(wire[g.wires[0]], wire[g.wires[1]]);
+    logical[wire[g.wires[0]]] = g.wires[0];
+    logical[wire[g.wires[1]]] = g.wires[1];
+    return;
+  }
+  gate moved = g;
+  for (int & q : moved) q = wire[q];
+  emit(moved);
+}
+
+void swap_relabeler::finish() {
+  for (int i = 0; i < (int)wire.size(); i++) {
+    if (wire[i] != i) {
+      const int w = wire[i], other = logical[i];
+      emit(gate(gate_type::TOF, {i, w}));
+      emit(gate(gate_type::TOF, {w, i}));
+      emit(gate(gate_type::TOF, {i, w}));
+      wire[other] = w;
+      logical[w] = other;
+      wire[i] = logical[i] = i;
+    }
+  }
+}
+
 vector<xor_func> init_matrix(
         initializer_list<initializer_list<int>> lst){
     vector<xor_func> cols{};
@@ -705,9 +975,9 @@ vector<xor_func> init_matrix(
 }
 
 list_compare_result
-list_compare(const list<string> & a, const list<string> & b) {
-    const set<string> set_a{a.begin(), a.end()},
-                      set_b{b.begin(), b.end()};
+list_compare(const gate & a, const gate & b) {
+    const set<int> set_a{a.begin(), a.end()},
+                   set_b{b.begin(), b.end()};
     const auto overlap = set_intersection_count(
             set_a.begin(), set_a.end(),
             set_b.begin(), set_b.end());
@@ -720,46 +990,35 @@ list_compare(const list<string> & a, const list<string> & b) {
     }
 
 }
-string stringify_gate(const pair<string,list<string>>& gate) {
+string stringify_gate(const gate & g, const vector<string> & names) {
     stringstream s{};
-    s << gate.first << ": ";
+    s << gate_name(g.type) << ": ";
     bool first = true;
-    for(const string& input : gate.second) {
+    for(int input : g) {
         if(!first) {s << ", ";}
         first = false;
-        s << input;
+        s << names.at(input);
     }
     return s.str();
 }
 
 
 vector<xor_func>
-CNOT_gates_to_matrix(const size_t num_wires, const size_t dim, const gatelist& gates, const vector<string>& names) {
+CNOT_gates_to_matrix(const size_t num_wires, const size_t dim, const gatelist& gates) {
     assert(num_wires <= dim);
     vector<xor_func> res(num_wires, xor_func{dim});
     // Start with identity and zeros.
     for(int i = 0; i < num_wires; i++) {
         res[i].set(i);
     }
-    // loopup make for name to wire.
-    map<string,int> name_to_wire;
-    for(int i = 0; i < names.size(); i++) {
-        name_to_wire.insert(make_pair(names[i], i));
-    }
-
     for(const auto& g : gates) {
-        if (g.first == "tof" && g.second.size() == 2) {
-            auto inputs = g.second.begin();
-            int target = name_to_wire.at(*inputs);
-            inputs++;
-            int control = name_to_wire.at(*inputs);
-            res[target] ^= res[control];
+        if (g.type == gate_type::TOF && g.size == 2) {
+            res.at(g.wires[0]) ^= res.at(g.wires[1]);
+        } else if (g.type == gate_type::SWAP) {
+            swap(res.at(g.wires[0]), res.at(g.wires[1]));
         } else {
-            cout << "Bad gate in CNOT_gates_to_matrix:";
-            cout << stringify_gate(g) << endl;
+            cout << "Bad gate in CNOT_gates_to_matrix: " << gate_name(g.type) << endl;
         }
     }
     return res;
 }
-
-
@@ -25,9 +25,12 @@ Author: Matthew Amy
 #include <list>
 #include <map>
 #include <set>
+#include <functional>
+#include <iostream>
 
 #include "types.h"
 #include "xor_func.h"
+#include "term_table.h"
 
 
 extern bool disp_log;
@@ -45,8 +48,7 @@ int to_upper_echelon_mut(int m, int n,
         std::function<void(int, int)> do_swap,
         std::function<void(int, int)> do_xor);
 gatelist to_upper_echelon(int m, int n,
-        const std::vector<xor_func>& bits,
-        const std::vector<std::string>& names);
+        const std::vector<xor_func>& bits);
 // Pair of matrix versions
 void to_upper_echelon(int m, int n,
         const std::vector<xor_func>& bits,
@@ -59,20 +61,81 @@ void backfill_matrix(int m, int n,
         std::vector<xor_func>& bits,
         std::function<void(int, int)> do_xor);
 gatelist to_lower_echelon(const int m, const int n,
-        std::vector<xor_func>& bits,
-        const std::vector<std::string> names);
+        std::vector<xor_func>& bits);
 void to_lower_echelon(const int m, const int n,
         std::vector<xor_func>& bits,
         std::vector<xor_func>& mat);
 
+// Where the pivots of a matrix in echelon form are
+struct echelon_pivots {
+  std::vector<int> col;   // of each row, or n if it has none
+  std::vector<int> row;   // with each column as its pivot, or -1
+  echelon_pivots() = default;
+  echelon_pivots(int m, int n, const std::vector<xor_func>& mat);
+};
+
+// The wires a layer starts from, reduced once for every construct_circuit
+//   call starting from them
+struct layer_context {
+  std::vector<xor_func> wires;
+  std::vector<xor_func> identity;   // num by num
+  std::vector<xor_func> in;         // wires in echelon form, but for AD_HOC
+  std::vector<xor_func> pre;        // takes wires to in
+  gatelist reduce;                  // or the gates doing it, for AD_HOC
+  echelon_pivots pivots;            // of in
+  layer_context(const std::vector<xor_func> & wires, int num, int dim);
+};
+
+gatelist construct_circuit(
+        const term_table & terms,
+        const std::vector<exponent_val> & phase,
+        const partitioning & part,
+        const layer_context & in,
+        const std::vector<xor_func>& out,
+        const int num,
+        const int dim);
 gatelist construct_circuit(
-        const exponents_set & phase,
+        const term_table & terms,
+        const std::vector<exponent_val> & phase,
         const partitioning & part,
-        std::vector<xor_func> in,
+        const std::vector<xor_func> & in,
         const std::vector<xor_func>& out,
         const int num,
-        const int dim,
-        const std::vector<std::string>& names);
+        const int dim);
+
+// Takes the swaps out of gates, relabelling the wires of every gate after
+//   one instead, then puts each of the num wires left out of place back with
+//   a swap of CNOTs at the end
+void relabel_swaps(gatelist & gates, int num);
+// relabel_swaps on a stream of gates, passed on to emit as they come
+class swap_relabeler {
+  std::vector<int> wire, logical;   // Where each wire is, and the reverse
+  gate_sink emit;
+public:
+  swap_relabeler(int num, gate_sink emit);
+  void push(const gate & g);
+  // Puts the wires back in place
+  void finish();
+};
+
+// Section sizes for Patel-Markov-Hayes CNOT synthesis, from the size of
+//   the matrix. A size uses the entry of the largest size up to it. With
+//   none, each size from 1 to log(n)/2 is tried and the shortest circuit
+//   kept
+extern std::map<int, int> pmh_sections;
+const int max_pmh_section = 64;
+// The section size for an n by n matrix, or 0 if there's no entry for it
+int pmh_section_size(int n);
+// Reads lines of "size section" into sections, # starting a comment.
+//   Returns false on a malformed line
+bool read_pmh_sections(std::istream & in, std::map<int, int> & sections);
+void write_pmh_sections(std::ostream & out, const std::map<int, int> & sections);
+// Synthesizes each matrix with sections of 1 to max_m bits, and returns the
+//   size using the fewest gates for each matrix size. The costs go to log
+std::map<int, int> tune_pmh(const std::vector<std::vector<xor_func>> & mats,
+        int max_m, std::ostream & log);
+// If set, sees each matrix before CNOT synthesis picks a section size for it
+extern std::function<void(const std::vector<xor_func>&)> pmh_observer;
 
 std::vector<xor_func> init_matrix(
         std::initializer_list<std::initializer_list<int>>);
@@ -99,8 +162,8 @@ size_t set_intersection_count(InputIt1 first1, InputIt1 last1,
 
 enum class list_compare_result { EQUAL, DISJOINT, OVERLAPPED };
 list_compare_result
-list_compare(const std::list<std::string> & a, const std::list<std::string> & b);
-std::string stringify_gate(const std::pair<std::string,std::list<std::string>>& gate);
+list_compare(const gate & a, const gate & b);
+std::string stringify_gate(const gate & g, const std::vector<std::string> & names);
 std::vector<xor_func>
-CNOT_gates_to_matrix(const size_t num_wires, const size_t dim, const gatelist& gates, const std::vector<std::string>& names);
+CNOT_gates_to_matrix(const size_t num_wires, const size_t dim, const gatelist& gates);
 #endif // UTIL_H
@@ -2,6 +2,8 @@
 #include <gtest/gtest.h>
 
 #include "util.h"
+#include "stats.h"
+#include "worker_pool.h"
 
 using namespace std;
 
@@ -105,33 +107,59 @@ TEST(computeRank, negatedFuncs) {
             }));
 }
 
-gatelist xor_com(int a, int b, const vector<string> names);
+// Wire names to print gates with
+static const vector<string> letters = {"A", "B", "C", "D", "E", "F"};
+
+void xor_com(gatelist & acc, int a, int b);
 TEST(components, xor) {
-    const gatelist x = xor_com(1,2, {"A", "B", "C"});
+    gatelist x;
+    xor_com(x, 1, 2);
     ASSERT_EQ(1, x.size());
-    EXPECT_EQ("tof: B, C", stringify_gate(*x.begin()));
+    EXPECT_EQ("tof: B, C", stringify_gate(x[0], letters));
 }
 
-gatelist swap_com(int a, int b, const vector<string> names);
+void swap_com(gatelist & acc, int a, int b);
 TEST(components, swap) {
-    const gatelist swap_cir = swap_com(1,2, {"A", "B", "C"});
-    EXPECT_EQ(3, swap_cir.size());
-    auto it = swap_cir.begin();
-    const auto a = *it; it++;
-    const auto b = *it; it++;
-    const auto c = *it; it++;
-    EXPECT_EQ("tof: B, C", stringify_gate(a));
-    EXPECT_EQ("tof: C, B", stringify_gate(b));
-    EXPECT_EQ("tof: B, C", stringify_gate(c));
+    gatelist swap_cir;
+    swap_com(swap_cir, 1, 2);
+    ASSERT_EQ(1, swap_cir.size());
+    EXPECT_EQ("swap: B, C", stringify_gate(swap_cir[0], letters));
+}
+
+TEST(components, relabelSwaps) {
+    // Swapping two wires back leaves them where they were, so only the CNOT
+    //   in between is left, on the wire its value had been moved to
+    gatelist gates;
+    swap_com(gates, 0, 1);
+    xor_com(gates, 0, 2);
+    swap_com(gates, 1, 0);
+    gates.push_back(gate(gate_type::H, {2}));
+    const auto expected = CNOT_gates_to_matrix(3, 3, gatelist(gates.begin(), gates.end() - 1));
+
+    relabel_swaps(gates, 3);
+    ASSERT_EQ(2, gates.size());
+    EXPECT_EQ("tof: B, C", stringify_gate(gates[0], letters));
+    EXPECT_EQ("H: C", stringify_gate(gates[1], letters));
+    gates.pop_back();
+    EXPECT_EQ(expected, CNOT_gates_to_matrix(3, 3, gates));
 
+    // One rotation is left to undo, with a swap for each wire out of place
+    //   but the last
+    swap_com(gates, 0, 1);
+    swap_com(gates, 1, 2);
+    const auto rotated = CNOT_gates_to_matrix(3, 3, gates);
+    relabel_swaps(gates, 3);
+    EXPECT_EQ(7, gates.size());
+    EXPECT_EQ(rotated, CNOT_gates_to_matrix(3, 3, gates));
 }
 
 // TODO X instead of tof is ok, right?
-gatelist x_com(int a, const vector<string> names);
+void x_com(gatelist & acc, int a);
 TEST(components, x) {
-    const gatelist x = x_com(2, {"A", "B", "C"});
+    gatelist x;
+    x_com(x, 2);
     EXPECT_EQ(1, x.size());
-    EXPECT_EQ("X: C", stringify_gate(*x.begin()));
+    EXPECT_EQ("X: C", stringify_gate(x[0], letters));
 }
 
 TEST(echelon, upperCallCount) {
@@ -215,17 +243,12 @@ TEST(echelon, upperGates) {
             {true, {0,1}},
             {false, {1,1}},
         };
-    gatelist gates = to_upper_echelon(2,2, arr, {"A", "B"});
+    gatelist gates = to_upper_echelon(2,2, arr);
     auto g = gates.begin();
-    EXPECT_EQ(4, gates.size()); // 1 X, 3 Swap
-    EXPECT_EQ("X: A", stringify_gate(*g));
-    g++;
-    // Swap
-    EXPECT_EQ("tof: B, A", stringify_gate(*g));
-    g++;
-    EXPECT_EQ("tof: A, B", stringify_gate(*g));
+    EXPECT_EQ(2, gates.size()); // 1 X, 1 Swap
+    EXPECT_EQ("X: A", stringify_gate(*g, letters));
     g++;
-    EXPECT_EQ("tof: B, A", stringify_gate(*g));
+    EXPECT_EQ("swap: B, A", stringify_gate(*g, letters));
     g++;
 }
 TEST(echelon, upperMat) {
@@ -437,15 +460,13 @@ fix_basis(int m, int n,
         const xor_func * fst,
         xor_func * snd,
         xor_func * mat,
-        const vector<string> names,
         bool has_mat);
 
 // Fixed interface versions
 gatelist
 fix_basis(int m, int n,
         const vector<xor_func>& fst,
-        vector<xor_func>& snd,
-        const vector<string>& names);
+        vector<xor_func>& snd);
 void
 fix_basis(int m, int n,
         const vector<xor_func>& fst,
@@ -509,6 +530,28 @@ TEST(fixBasis, emptySnd) {
     // if we don't have any existing constraints
     // on what the outputs should be, do nothing, get id out.
 }
+TEST(fixBasis, wideRows) {
+    // Rows spanning three words, which differ only past the first
+    vector<xor_func> A(3, xor_func(130)), B(3, xor_func(130));
+    A[0].set(0); A[0].set(70); A[0].set(129);
+    A[1].set(70);
+    A[2].set(129);
+    B[0].set(0);
+    B[1].set(70);
+    B[2].set(129);
+    vector<xor_func> C {
+            {false, {1,0,0}},
+            {false, {0,1,0}},
+            {false, {0,0,1}},
+        };
+
+    fix_basis(3, 130, A, B, C);
+    EXPECT_EQ(A, B);
+    EXPECT_EQ((xor_func{false, {1,1,1}}), C[0]);
+    EXPECT_EQ((xor_func{false, {0,1,0}}), C[1]);
+    EXPECT_EQ((xor_func{false, {0,0,1}}), C[2]);
+}
+
 void compose(int num, vector<xor_func>& A, const vector<xor_func>& B);
 TEST(compose, basic) {
 
@@ -536,14 +579,14 @@ TEST(compose, basic) {
     EXPECT_EQ(false, A[2][2]);
 }
 
-gatelist Lwr_CNOT_synth(int n, int m, vector<xor_func>& bits, const vector<string>& names, bool rev);
+gatelist Lwr_CNOT_synth(int n, int m, vector<xor_func>& bits, bool rev);
 TEST(LwrCNotSynth, id3x3) {
     auto arr = vector<xor_func>{
             {false, {1,0,0}},
             {false, {0,1,0}},
             {false, {0,0,1}},
         };
-    auto gates = Lwr_CNOT_synth(3, 1, arr, {"A", "B", "C"}, false);
+    auto gates = Lwr_CNOT_synth(3, 1, arr, false);
     EXPECT_EQ(0, gates.size());
 }
 TEST(LwrCNotSynth, revId3x3) {
@@ -552,13 +595,13 @@ TEST(LwrCNotSynth, revId3x3) {
             {false, {0,1,0}},
             {false, {1,0,0}},
         };
-    auto gates = Lwr_CNOT_synth(3, 1, arr, {"A", "B", "C"}, false);
+    auto gates = Lwr_CNOT_synth(3, 1, arr, false);
     // Should be just a swap
     ASSERT_EQ(2, gates.size());
     auto g = gates.begin();
     // Parial swap
-    EXPECT_EQ("tof: A, C", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: C, A", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: A, C", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: C, A", stringify_gate(*g, letters)); g++;
 }
 TEST(LwrCNotSynth, 4x4) {
     auto arr = vector<xor_func>{
@@ -567,10 +610,10 @@ TEST(LwrCNotSynth, 4x4) {
             {false, {0,1,0,0}},
             {false, {1,1,1,0}},
         };
-    auto gates = Lwr_CNOT_synth(4, 2, arr, {"A", "B", "C", "D"}, false);
+    auto gates = Lwr_CNOT_synth(4, 2, arr, false);
     /*
     for(const auto& g : gates){
-        cout << stringify_gate(g) << endl;
+        cout << stringify_gate(g, letters) << endl;
     }
     */
     // All the arguments to the gates are backwards,
@@ -580,12 +623,12 @@ TEST(LwrCNotSynth, 4x4) {
     // 4 -> 1 + 4
     auto g = gates.begin();
     // Fix bottom row
-    EXPECT_EQ("tof: D, A", stringify_gate(*g));
+    EXPECT_EQ("tof: D, A", stringify_gate(*g, letters));
     g++;
     // Fix box 0,0
-    EXPECT_EQ("tof: B, A", stringify_gate(*g));
+    EXPECT_EQ("tof: B, A", stringify_gate(*g, letters));
     g++;
-    EXPECT_EQ("tof: C, B", stringify_gate(*g));
+    EXPECT_EQ("tof: C, B", stringify_gate(*g, letters));
     g++;
 
 }
@@ -598,35 +641,34 @@ TEST(LwrCNotSynth, 6x6) {
             {false, {1,1,0,1,1,1}},
             {false, {0,0,1,1,1,0}},
         };
-    auto gates = Lwr_CNOT_synth(6, 2, arr,
-            {"A", "B", "C", "D", "E", "F"}, false);
+    auto gates = Lwr_CNOT_synth(6, 2, arr, false);
     /*for(const auto& g : gates){
-        cout << stringify_gate(g) << endl;
+        cout << stringify_gate(g, letters) << endl;
     }*/
     // Fix last 2
     // 4 -> 1 + 4
     auto g = gates.begin();
     // A -> D
-    EXPECT_EQ("tof: D, A", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: D, A", stringify_gate(*g, letters)); g++;
     // A -> E
-    EXPECT_EQ("tof: E, A", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: E, A", stringify_gate(*g, letters)); g++;
     // A -> B
-    EXPECT_EQ("tof: B, A", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: B, A", stringify_gate(*g, letters)); g++;
     // B -> C
-    EXPECT_EQ("tof: C, B", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: C, B", stringify_gate(*g, letters)); g++;
     // C -> E
-    EXPECT_EQ("tof: E, C", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: E, C", stringify_gate(*g, letters)); g++;
     // D -> F
-    EXPECT_EQ("tof: F, D", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: F, D", stringify_gate(*g, letters)); g++;
     // D -> C
-    EXPECT_EQ("tof: C, D", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: C, D", stringify_gate(*g, letters)); g++;
     // C -> D
-    EXPECT_EQ("tof: D, C", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: D, C", stringify_gate(*g, letters)); g++;
     EXPECT_EQ(g, gates.end());
 }
 
-gatelist CNOT_synth(int n, int num_segments, vector<xor_func>& bits, const vector<string> names);
-gatelist CNOT_synth(int n, vector<xor_func>& bits, const vector<string> names);
+gatelist CNOT_synth(int n, int num_segments, vector<xor_func>& bits);
+gatelist CNOT_synth(int n, vector<xor_func>& bits);
 TEST(CNotSynth, 2x2upper) {
     auto arr = vector<xor_func>{
         {false, {1, 1}},
@@ -634,13 +676,12 @@ TEST(CNotSynth, 2x2upper) {
     };
     const auto arr_initial = arr;
     // That'll have the gate produced after the transpose
-    auto gates = CNOT_synth(2, 1, arr, {"A", "B"});
+    auto gates = CNOT_synth(2, 1, arr);
     ASSERT_EQ(1, gates.size());
     auto g = gates.begin();
-    EXPECT_EQ("tof: A, B", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: A, B", stringify_gate(*g, letters)); g++;
     EXPECT_EQ(gates.end(), g);
-    auto reconstructed = CNOT_gates_to_matrix(2, 2, gates,
-            {"A", "B"});
+    auto reconstructed = CNOT_gates_to_matrix(2, 2, gates);
     EXPECT_EQ(arr_initial, reconstructed);
 }
 TEST(CNotSynth, 2x2lowwer) {
@@ -650,13 +691,12 @@ TEST(CNotSynth, 2x2lowwer) {
     };
     const auto arr_initial = arr;
     // That'll have the gate produced after the transpose
-    auto gates = CNOT_synth(2, 1, arr, {"A", "B"});
+    auto gates = CNOT_synth(2, 1, arr);
     ASSERT_EQ(1, gates.size());
     auto g = gates.begin();
-    EXPECT_EQ("tof: B, A", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: B, A", stringify_gate(*g, letters)); g++;
     EXPECT_EQ(gates.end(), g);
-    auto reconstructed = CNOT_gates_to_matrix(2, 2, gates,
-            {"A", "B"});
+    auto reconstructed = CNOT_gates_to_matrix(2, 2, gates);
     EXPECT_EQ(arr_initial, reconstructed);
 
 }
@@ -667,20 +707,19 @@ TEST(CNotSynth, revId3x3) {
             {false, {1,0,0}},
         };
     const auto arr_initial = arr;
-    auto gates = CNOT_synth(3, 1, arr, {"A", "B", "C"});
+    auto gates = CNOT_synth(3, 1, arr);
     // Should be just a swap
     ASSERT_EQ(3, gates.size());
     auto g = gates.begin();
     // Parial swap
-    EXPECT_EQ("tof: A, C", stringify_gate(*g));
+    EXPECT_EQ("tof: A, C", stringify_gate(*g, letters));
     g++;
-    EXPECT_EQ("tof: C, A", stringify_gate(*g));
+    EXPECT_EQ("tof: C, A", stringify_gate(*g, letters));
     g++;
-    EXPECT_EQ("tof: A, C", stringify_gate(*g));
+    EXPECT_EQ("tof: A, C", stringify_gate(*g, letters));
     g++;
 
-    const auto recreated_arr = CNOT_gates_to_matrix(3, 3, gates,
-            {"A", "B", "C"});
+    const auto recreated_arr = CNOT_gates_to_matrix(3, 3, gates);
     EXPECT_EQ(arr_initial, recreated_arr);
 }
 TEST(CNotSynth, 6x6) {
@@ -693,11 +732,10 @@ TEST(CNotSynth, 6x6) {
             {false, {0,0,1,1,1,0}},
         };
     const auto arr_initial = arr;
-    auto gates = CNOT_synth(6, 2, arr,
-            {"A", "B", "C", "D", "E", "F"});
+    auto gates = CNOT_synth(6, 2, arr);
     /*
     for(const auto& g : gates){
-        cout << stringify_gate(g) << endl;
+        cout << stringify_gate(g, letters) << endl;
     }
     */
 
@@ -705,26 +743,26 @@ TEST(CNotSynth, 6x6) {
     // Going through it backwards.
     auto g = gates.begin();
     // A -> D
-    EXPECT_EQ("tof: D, E", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: A, B", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: B, D", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: C, F", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: C, E", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: D, E", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: E, F", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: D, E", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: A, B", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: B, D", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: C, F", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: C, E", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: D, E", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: E, F", stringify_gate(*g, letters)); g++;
     // Flip
-    EXPECT_EQ("tof: D, C", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: C, D", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: F, D", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: E, C", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: C, B", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: B, A", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: E, A", stringify_gate(*g)); g++;
-    EXPECT_EQ("tof: D, A", stringify_gate(*g)); g++;
+    EXPECT_EQ("tof: D, C", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: C, D", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: F, D", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: E, C", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: C, B", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: B, A", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: E, A", stringify_gate(*g, letters)); g++;
+    EXPECT_EQ("tof: D, A", stringify_gate(*g, letters)); g++;
     EXPECT_EQ(g, gates.end());
     /* cout << "Recreating matrix" << endl; */
     const auto recreated_arr =
-        CNOT_gates_to_matrix(6,6, gates, {"A", "B", "C", "D", "E", "F"});
+        CNOT_gates_to_matrix(6,6, gates);
 
     /* cout << recreated_arr; */
     EXPECT_EQ(arr_initial, recreated_arr);
@@ -733,8 +771,7 @@ TEST(CNotSynth, 6x6) {
 
 TEST(CNotGatesToMatrix, 2x2) {
     auto arr = CNOT_gates_to_matrix(2, 2,
-            {{"tof", {"A", "B"}}},
-            {"A", "B"});
+            {gate(gate_type::TOF, {0, 1})});
     ASSERT_EQ(2, arr.size());
     ASSERT_EQ(2, arr[0].size());
     EXPECT_EQ((xor_func{false, {1, 1}}), arr[0]);
@@ -742,50 +779,108 @@ TEST(CNotGatesToMatrix, 2x2) {
 }
 // TODO more tests
 
-gatelist CNOT_synth(int n,
-        vector<xor_func>& bits,
-        const vector<string> names);
 TEST(CNotSynth, I3x3) {
     vector<xor_func> arr{
         {false, {1,0,0}},
         {false, {0,1,0}},
         {false, {0,0,1}},
     };
-    gatelist gates = CNOT_synth(3, arr, {"A", "B", "C"});
+    gatelist gates = CNOT_synth(3, arr);
     EXPECT_EQ(0, gates.size());
 }
+TEST(CNotSynth, wideSections) {
+    // A 70x70 invertible matrix, from CNOTs on the identity
+    const int n = 70;
+    vector<xor_func> arr;
+    for (int i = 0; i < n; i++) {
+        arr.emplace_back(n);
+        arr[i].set(i);
+    }
+    unsigned seed = 1;
+    for (int k = 0; k < 500; k++) {
+        seed = seed * 1103515245 + 12345;
+        const int a = (seed >> 8) % n, b = (seed >> 20) % n;
+        if (a != b) arr[a] ^= arr[b];
+    }
+    const auto arr_initial = arr;
+
+    // Section sizes that don't divide n, ones too wide for a table of every
+    //   pattern, and the untuned choice
+    for (int m : {1, 3, 8, 24, max_pmh_section, 0}) {
+        auto bits = arr_initial;
+        auto gates = m == 0 ? CNOT_synth(n, bits) : CNOT_synth(n, m, bits);
+        EXPECT_EQ(arr_initial, CNOT_gates_to_matrix(n, n, gates)) << "m = " << m;
+    }
+}
+TEST(CNotSynth, pmhSections) {
+    map<int, int> sections;
+    istringstream in("# tuned\n4 1\n\n20 3  # large\n");
+    ASSERT_TRUE(read_pmh_sections(in, sections));
+    EXPECT_EQ((map<int, int>{{4, 1}, {20, 3}}), sections);
+    istringstream bad("4 99\n");
+    EXPECT_FALSE(read_pmh_sections(bad, sections));
+
+    ostringstream out;
+    write_pmh_sections(out, {{4, 1}, {20, 3}});
+    istringstream again(out.str());
+    map<int, int> read_back;
+    ASSERT_TRUE(read_pmh_sections(again, read_back));
+    EXPECT_EQ((map<int, int>{{4, 1}, {20, 3}}), read_back);
+
+    pmh_sections = {{4, 1}, {20, 3}};
+    EXPECT_EQ(0, pmh_section_size(3));
+    EXPECT_EQ(1, pmh_section_size(19));
+    EXPECT_EQ(3, pmh_section_size(64));
+    pmh_sections.clear();
+
+    // One entry per matrix size, each a size that was tried
+    vector<vector<xor_func>> mats = {
+        {{false, {1,1,0}}, {false, {0,1,0}}, {false, {0,1,1}}},
+        {{false, {0,1}}, {false, {1,1}}},
+        {{false, {1,0}}, {false, {1,1}}},
+    };
+    ostringstream log;
+    auto tuned = tune_pmh(mats, 8, log);
+    ASSERT_EQ(2, tuned.size());
+    EXPECT_LE(1, tuned[2]);
+    EXPECT_GE(2, tuned[2]);
+    EXPECT_LE(1, tuned[3]);
+    EXPECT_GE(3, tuned[3]);
+}
 // Future TODO construct_curcuit
 
 
 TEST(listCompare, baseline) {
     EXPECT_EQ(list_compare_result::EQUAL,
-              list_compare({"A", "B", "C"}, {"A", "B", "C"}));
+              list_compare(gate(gate_type::Z, {0, 1, 2}), gate(gate_type::Z, {0, 1, 2})));
     EXPECT_EQ(list_compare_result::OVERLAPPED,
-              list_compare({"A", "D", "B"}, {"A", "B", "C"}));
+              list_compare(gate(gate_type::Z, {0, 3, 1}), gate(gate_type::Z, {0, 1, 2})));
     EXPECT_EQ(list_compare_result::DISJOINT,
-              list_compare({"A"}, {"D"}));
+              list_compare(gate(gate_type::T, {0}), gate(gate_type::T, {3})));
     EXPECT_EQ(list_compare_result::DISJOINT,
-              list_compare({"A", "B", "C"}, {"D", "E", "F"}));
+              list_compare(gate(gate_type::Z, {0, 1, 2}), gate(gate_type::Z, {3, 4, 5})));
 }
 
 TEST(listCompare, abABC) {
     EXPECT_EQ(list_compare_result::OVERLAPPED,
-              list_compare({"A", "B"}, {"A", "B", "C"}));
+              list_compare(gate(gate_type::TOF, {0, 1}), gate(gate_type::Z, {0, 1, 2})));
 }
 
 TEST(listCompare, orderingTest) {
-    EXPECT_EQ(list_compare_result::EQUAL, list_compare({"A", "C", "B"}, {"A", "B", "C"}));
+    EXPECT_EQ(list_compare_result::EQUAL,
+              list_compare(gate(gate_type::Z, {0, 2, 1}), gate(gate_type::Z, {0, 1, 2})));
 }
 
 TEST(stringifyGate, basic) {
     gatelist g = {
-        {"tof", {"A", "B", "C"}},
-        {"X", {"A", "D", "boom"}}};
+        gate(gate_type::TOF, {0, 1, 2}),
+        gate(gate_type::X, {0, 3, 2})};
     auto it = g.begin();
-    EXPECT_EQ("tof: A, B, C", stringify_gate(*it));
+    EXPECT_EQ("tof: A, B, C", stringify_gate(*it, {"A", "B", "C", "D"}));
     it++;
-    EXPECT_EQ("X: A, D, boom", stringify_gate(*it));
+    EXPECT_EQ("X: A, D, boom", stringify_gate(*it, {"A", "B", "boom", "D"}));
 }
+
 /*  Needs to be manually inspected.
 void print_wires(const vector<xor_func> wires);
 TEST(utilTest, printing) {
@@ -801,3 +896,63 @@ TEST(utilTest, printing) {
             }));
 }
 */
+
+TEST(utilTest, constructCircuitThreads) {
+    // Six single term partitions over four wires
+    const int num = 4, dim = 4;
+    term_table terms(dim);
+    partitioning part;
+    vector<exponent_val> phase;
+    for (const xor_func & f : init_matrix({
+                {1,1,0,0}, {0,1,1,0}, {0,0,1,1}, {1,0,0,1}, {1,1,1,0}, {0,1,1,1}})) {
+        part.push_back(term_set{terms.intern(f)});
+        phase.push_back(1);
+    }
+    const vector<xor_func> wires = init_matrix({
+                {1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,0,1}});
+
+    const gatelist serial = construct_circuit(terms, phase, part, wires, wires, num, dim);
+    shared_workers().resize(3);
+    const gatelist parallel = construct_circuit(terms, phase, part, wires, wires, num, dim);
+    shared_workers().resize(1);
+
+    EXPECT_EQ(serial, parallel);
+    EXPECT_EQ(6, count_if(serial.begin(), serial.end(),
+                [](const gate & g) { return g.type == gate_type::T; }));
+}
+
+TEST(utilTest, constructCircuitPortfolio) {
+    const int num = 4, dim = 4;
+    term_table terms(dim);
+    partitioning part;
+    vector<exponent_val> phase;
+    for (const xor_func & f : init_matrix({
+                {1,1,0,0}, {0,1,1,0}, {0,0,1,1}, {1,0,1,1}})) {
+        part.push_back(term_set{terms.intern(f)});
+        phase.push_back(1);
+    }
+    const vector<xor_func> wires = init_matrix({
+                {1,0,0,0}, {0,1,0,0}, {0,0,1,0}, {0,0,0,1}});
+    auto wins = []() {
+        unsigned long ret = 0;
+        for (const auto& w : local_stats().portfolio_wins) ret += w.second;
+        return ret;
+    };
+
+    const unsigned long before = wins();
+    synth_method = PORTFOLIO;
+    const gatelist best = construct_circuit(terms, phase, part, wires, wires, num, dim);
+    const unsigned long first = wins();
+    // The same layers again come from the cnot_cache, and still count
+    const gatelist again = construct_circuit(terms, phase, part, wires, wires, num, dim);
+    synth_method = PMH;
+
+    // One win per CNOT layer, at most one per partition and one for the
+    //   output
+    EXPECT_LT(before, first);
+    EXPECT_GE(before + 5, first);
+    EXPECT_EQ(first - before, wins() - first);
+    EXPECT_EQ(best, again);
+    EXPECT_EQ(4, count_if(best.begin(), best.end(),
+                [](const gate & g) { return g.type == gate_type::T; }));
+}
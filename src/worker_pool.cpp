@@ -0,0 +1,110 @@
+#include <atomic>
+#include <exception>
+
+#include "worker_pool.h"
+
+using namespace std;
+
+static thread_local bool running_task = false;
+
+bool worker_pool::in_task() {
+  return running_task;
+}
+
+void worker_pool::work() {
+  running_task = true;
+  while (true) {
+    function<void()> task;
+    {
+      unique_lock<mutex> guard(lock);
+      ready.wait(guard, [this]() { return stopping || !tasks.empty(); });
+      if (tasks.empty()) return;
+      task = move(tasks.front());
+      tasks.pop_front();
+    }
+    task();
+  }
+}
+
+void worker_pool::stop() {
+  {
+    lock_guard<mutex> guard(lock);
+    stopping = true;
+  }
+  ready.notify_all();
+  for (auto & t : threads) t.join();
+  threads.clear();
+  stopping = false;
+}
+
+void worker_pool::enqueue(function<void()> task, bool first) {
+  {
+    lock_guard<mutex> guard(lock);
+    if (first) tasks.push_front(move(task));
+    else       tasks.push_back(move(task));
+  }
+  ready.notify_one();
+}
+
+void worker_pool::resize(int size) {
+  stop();
+  for (int i = 1; i < size; i++) {
+    threads.emplace_back([this]() { work(); });
+  }
+}
+
+// The indices of one call to run, handed out to whoever asks first. Shared
+//   with the helpers, which may only get to it after run has returned
+struct batch {
+  function<void(size_t)> body;
+  size_t count;
+  atomic<size_t> next{0};
+  vector<exception_ptr> errors;
+  mutex lock;
+  condition_variable finished;
+  size_t done = 0;
+
+  batch(function<void(size_t)> body, size_t count) :
+    body(move(body)), count(count), errors(count) { }
+
+  void work() {
+    for (size_t i = next++; i < count; i = next++) {
+      try {
+        body(i);
+      } catch (...) {
+        errors[i] = current_exception();
+      }
+      lock_guard<mutex> guard(lock);
+      if (++done == count) finished.notify_all();
+    }
+  }
+};
+
+void worker_pool::run(size_t count, function<void(size_t)> body) {
+  if (count == 0) return;
+  auto b = make_shared<batch>(move(body), count);
+
+  const size_t helpers = min(threads.size(), count - 1);
+  for (size_t i = 0; i < helpers; i++) {
+    enqueue([b]() { b->work(); }, true);
+  }
+  const bool was_running = running_task;
+  running_task = true;
+  b->work();
+  running_task = was_running;
+
+  {
+    unique_lock<mutex> guard(b->lock);
+    b->finished.wait(guard, [&b]() { return b->done == b->count; });
+  }
+  for (const auto & error : b->errors) {
+    if (error) rethrow_exception(error);
+  }
+}
+
+// Never destroyed, as its threads count into statics that may be gone by
+//   the time it would be
+worker_pool & shared_workers() {
+  static worker_pool * pool = new worker_pool();
+  return *pool;
+}
@@ -0,0 +1,60 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <future>
+#include <memory>
+#include <functional>
+#include <condition_variable>
+
+// A fixed set of threads shared by every level of parallelism, so work
+//   started from inside other work waits for a free thread instead of
+//   starting more. The thread waiting on a batch works on it too, so it
+//   finishes even when every worker is busy.
+class worker_pool {
+    std::vector<std::thread> threads;
+    std::deque<std::function<void()>> tasks;
+    std::mutex lock;
+    std::condition_variable ready;
+    bool stopping = false;
+
+    void work();
+    void stop();
+    // Helpers of a batch go first, so running work finishes before more starts
+    void enqueue(std::function<void()> task, bool first);
+  public:
+    // size counts the thread that hands out the work
+    explicit worker_pool(int size = 1) { resize(size); }
+    ~worker_pool() { stop(); }
+    worker_pool(const worker_pool &) = delete;
+    worker_pool & operator=(const worker_pool &) = delete;
+
+    // Only while nothing is running on the pool
+    void resize(int size);
+    int size() const { return threads.size() + 1; }
+    // Whether the calling thread is running work from a pool, as a worker or
+    //   while it waits on a batch
+    static bool in_task();
+
+    // Runs body(0), ..., body(count - 1) on the calling thread and any idle
+    //   workers. Rethrows the first exception thrown, once all of them have
+    //   finished
+    void run(size_t count, std::function<void(size_t)> body);
+
+    // Runs task on a worker, or right away if there are none
+    template <typename F>
+    auto submit(F task) -> std::future<decltype(task())> {
+      auto job = std::make_shared<std::packaged_task<decltype(task())()>>(std::move(task));
+      auto ret = job->get_future();
+      if (threads.empty()) (*job)();
+      else enqueue([job]() { (*job)(); }, false);
+      return ret;
+    }
+};
+
+// The pool construct_circuit and the layer pipeline share
+worker_pool & shared_workers();
+#endif // WORKER_POOL_H
@@ -0,0 +1,49 @@
+#include <gtest/gtest.h>
+#include <stdexcept>
+
+#include "worker_pool.h"
+
+using namespace std;
+
+TEST(workerPool, runsEveryIndex) {
+    worker_pool pool(3);
+    EXPECT_EQ(3, pool.size());
+
+    vector<int> done(20, 0);
+    pool.run(done.size(), [&done](size_t i) { done[i] += i + 1; });
+    for (size_t i = 0; i < done.size(); i++) {
+        EXPECT_EQ((int)i + 1, done[i]);
+    }
+
+    EXPECT_THROW(pool.run(3, [](size_t i) {
+        if (i == 1) throw logic_error("failed");
+    }), logic_error);
+}
+
+TEST(workerPool, nestedRunsFinish) {
+    // Every worker ends up waiting on an inner batch, which the waiting
+    //   threads finish themselves
+    worker_pool pool(2);
+    vector<int> done(16, 0);
+    pool.run(4, [&pool, &done](size_t i) {
+        pool.run(4, [i, &done](size_t j) { done[4 * i + j] = 1; });
+    });
+    EXPECT_EQ(vector<int>(16, 1), done);
+}
+
+TEST(workerPool, submit) {
+    worker_pool serial;
+    EXPECT_EQ(1, serial.size());
+    EXPECT_EQ(2, serial.submit([]() { return 2; }).get());
+
+    worker_pool pool(2);
+    auto result = pool.submit([]() { return worker_pool::in_task(); });
+    EXPECT_TRUE(result.get());
+    EXPECT_FALSE(worker_pool::in_task());
+
+    // The caller works on its own batch too
+    vector<int> in_task(4, 0);
+    pool.run(in_task.size(), [&in_task](size_t i) { in_task[i] = worker_pool::in_task(); });
+    EXPECT_EQ(vector<int>(4, 1), in_task);
+    EXPECT_FALSE(worker_pool::in_task());
+}
@@ -31,21 +31,16 @@ std::ostream& operator<<(std::ostream& out, const std::vector<xor_func>& arr) {
     return out;
 }
 
-// Returns a int in range [0, 2^offset -1]
-// It will be different for each xor_func,
-// beyond that there are no guarantees
+// Returns a int in range [0, 2^offset -1], bit i being bits[start+i].
+// Bits past the end are 0, and the xor_func may be any length.
 unsigned long
-xor_func::slice(size_t start, size_t offset) {
-    const size_t left_edge = offset;
-    const size_t right_edge = start;
-    const unsigned long bits = bitset.to_ulong();
-    /* cout << "slicing " <<  bits << "["; */
-    /* cout << left_edge <<"..." << right_edge << "]" << endl; */
-    // Line up bits[start+offset] with result[0]
-    const unsigned long aligned = bits >> (right_edge);
-    // Mask out all the higher bits
-    const unsigned long mask = ~((~0) << left_edge);
-    return aligned & mask;
+xor_func::slice(size_t start, size_t offset) const {
+    assert(offset <= 8 * sizeof(unsigned long));
+    unsigned long ret = 0;
+    for (size_t i = 0; i < offset && start + i < bitset.size(); i++) {
+        if (bitset[start + i]) ret |= 1ul << i;
+    }
+    return ret;
 }
 
 
@@ -18,7 +18,7 @@ class xor_func {
         bool is_negated() const { return negated; }
         void negate() { negated = !negated; }
 
-        unsigned long slice(size_t start, size_t offset);
+        unsigned long slice(size_t start, size_t offset) const;
 
         xor_func operator^(const xor_func& b) const {
             return xor_func(negated ^ b.negated,
@@ -56,12 +56,21 @@ class xor_func {
         void reset() { bitset.reset(); }
         void flip(const size_t i) { bitset.flip(i); }
         bool none() const { return bitset.none(); }
+        size_t count() const { return bitset.count(); }
         bool any() const { return bitset.any(); }
 
         void resize(size_t num_bits, bool value = false) {
             bitset.resize(num_bits, value);
         }
 
+        const boost::dynamic_bitset<> & bits() const { return bitset; }
+        // Packed access to the bits, num_blocks() words of bits_per_block
+        size_t num_blocks() const { return bitset.num_blocks(); }
+        template <typename BlockOutputIterator>
+        void to_blocks(BlockOutputIterator out) const {
+            boost::to_block_range(bitset, out);
+        }
+
         bool operator[](const size_t& i) const {
             return this->bitset[i];
         }
@@ -24,6 +24,18 @@ TEST(xorFuncSlice, mid) {
     /* EXPECT_EQ(3, slow_slice(bits,1,3)); */
 }
 
+TEST(xorFuncSlice, wide) {
+    xor_func bits(130);
+    bits.set(127);
+    bits.set(129);
+    EXPECT_EQ(5, bits.slice(127, 3));
+    EXPECT_EQ(1, bits.slice(129, 8));
+    EXPECT_EQ(0, bits.slice(0, 8));
+    // A whole word, across two blocks, with 127 and 129 still set
+    bits.set(66);
+    EXPECT_EQ((1ul << 63) | (1ul << 61) | 1, bits.slice(66, 64));
+}
+
 TEST(constructors, copyConstructor) {
     const xor_func a{false, {0, 1, 1, 0, 0}};
     xor_func b{a};
@@ -12,7 +12,7 @@
 # All tests produced by this Makefile.  Remember to add new tests you
 # created to the list.
 # The tests seems to be run in this order.
-TESTS = util_test circuit_test partition_test oracle_test dotqc_test
+TESTS = util_test circuit_test partition_test oracle_test dotqc_test stats_test term_table_test rank_tracker_test cnot_cache_test xor_func_test worker_pool_test
 #######################################################################
 
 # Please tweak the following variable definitions as needed by your